@@ -208,7 +208,7 @@ draw_meter(
 	}
 
 	// Write the current level
-	bmp_printf( FONT_SMALL, 0, y_origin, "%3d", db_avg );
+	bmp_cell_printf( FONT_SMALL, 0, y_origin, "%3d", db_avg );
 }
 
 
@@ -623,7 +623,7 @@ audio_mgain_display( void * priv, int x, int y, int selected )
 	unsigned gain_reg= *(unsigned*) priv;
 	gain_reg &= 0x7;
 
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -648,7 +648,7 @@ audio_dgain_toggle( void * priv )
 static void
 audio_dgain_display( void * priv, int x, int y, int selected )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		// 23456789012
@@ -662,7 +662,7 @@ audio_dgain_display( void * priv, int x, int y, int selected )
 static void
 audio_lovl_display( void * priv, int x, int y, int selected )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -680,7 +680,7 @@ audio_o2gain_display( void * priv, int x, int y, int selected )
 	unsigned gain_reg= *(unsigned*) priv;
 	gain_reg &= 0x3;
 
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789
@@ -694,7 +694,7 @@ audio_o2gain_display( void * priv, int x, int y, int selected )
 static void
 audio_alc_display( void * priv, int x, int y, int selected )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -707,7 +707,7 @@ audio_alc_display( void * priv, int x, int y, int selected )
 static void
 audio_mic_in_display( void * priv, int x, int y, int selected )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -719,7 +719,7 @@ audio_mic_in_display( void * priv, int x, int y, int selected )
 static void
 audio_loopback_display( void * priv, int x, int y, int selected )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -0,0 +1,314 @@
+/** \file
+ * Transparent image blits into the BMP VRAM.
+ *
+ * The mask is stored as a list of runs for each row, so an icon
+ * with a hole in the middle or a set of frame lines is a handful
+ * of runs per row.  Clipping is done on the runs: each one is cut
+ * to the screen and then split around the excluded boxes that
+ * cross its row.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "bmp.h"
+#include "span.h"
+#include "blit.h"
+
+static const struct overlay_rect *	exclude[ BLIT_MAX_EXCLUDE ];
+static unsigned				exclude_count;
+
+
+int
+bmp_blit_exclude(
+	const struct overlay_rect * rect
+)
+{
+	if( exclude_count >= BLIT_MAX_EXCLUDE )
+		return 0;
+
+	exclude[ exclude_count++ ] = rect;
+	return 1;
+}
+
+
+/** Count the opaque runs of one row, or store them if runs is set */
+static unsigned
+blit_row_runs(
+	const uint8_t *		row,
+	unsigned		width,
+	uint8_t			key,
+	struct blit_run *	runs
+)
+{
+	unsigned x = 0;
+	unsigned count = 0;
+
+	while( x < width )
+	{
+		while( x < width && row[x] == key )
+			x++;
+		if( x == width )
+			break;
+
+		const unsigned start = x;
+		while( x < width && row[x] != key )
+			x++;
+
+		if( runs )
+		{
+			runs[count].x	= start;
+			runs[count].len	= x - start;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+
+struct bmp_image *
+bmp_image_create(
+	const uint8_t *		pixels,
+	unsigned		width,
+	unsigned		height,
+	int			pitch,
+	uint8_t			key
+)
+{
+	unsigned y, count = 0;
+
+	if( width == 0 || width > 0xFFFF || height == 0 || height > 0xFFFF )
+		return NULL;
+
+	for( y=0 ; y<height ; y++ )
+		count += blit_row_runs( pixels + (int) y * pitch, width, key, NULL );
+
+	const size_t rows_size = (height + 1) * sizeof(uint32_t);
+	struct bmp_image * const image = malloc(
+		sizeof(*image) + rows_size + count * sizeof(struct blit_run)
+	);
+	if( !image )
+		return NULL;
+
+	uint32_t * const rows = (void*)( image + 1 );
+	struct blit_run * const runs = (void*)( (uint8_t*) rows + rows_size );
+
+	count = 0;
+	for( y=0 ; y<height ; y++ )
+	{
+		rows[y] = count;
+		count += blit_row_runs( pixels + (int) y * pitch, width, key, &runs[count] );
+	}
+	rows[height] = count;
+
+	image->width	= width;
+	image->height	= height;
+	image->pixels	= pixels;
+	image->pitch	= pitch;
+	image->rows	= rows;
+	image->runs	= runs;
+
+	DebugMsg( DM_MAGIC, 3, "%s: %dx%d, %d runs",
+		__func__,
+		width,
+		height,
+		count
+	);
+
+	return image;
+}
+
+
+struct bmp_image *
+bmp_image_from_bmp(
+	const struct bmp_file_t * bmp,
+	uint8_t			key
+)
+{
+	if( !bmp
+	||  bmp->bits_per_pixel != 8
+	||  bmp->compression != 0
+	||  bmp->width == 0 || bmp->width > 0xFFFF
+	||  bmp->height == 0 || bmp->height > 0xFFFF )
+		return NULL;
+
+	// Rows are padded to words and stored bottom up
+	const unsigned stride = (bmp->width + 3) & ~3;
+
+	// A truncated file would have the blits read past the buffer
+	const unsigned image_offset = bmp->image - (const uint8_t*) bmp;
+	if( image_offset > bmp->size
+	||  stride * bmp->height > bmp->size - image_offset )
+	{
+		DebugMsg( DM_MAGIC, 3, "%s: %dx%d does not fit in %d bytes",
+			__func__,
+			bmp->width,
+			bmp->height,
+			bmp->size
+		);
+		return NULL;
+	}
+
+	return bmp_image_create(
+		bmp->image + (bmp->height - 1) * stride,
+		bmp->width,
+		bmp->height,
+		-(int) stride,
+		key
+	);
+}
+
+
+void
+bmp_image_free(
+	struct bmp_image *	image
+)
+{
+	if( image )
+		free( image );
+}
+
+
+/** Excluded boxes that cross screen row y, as sorted x ranges */
+static unsigned
+blit_row_exclude(
+	unsigned		y,
+	uint16_t *		x0s,
+	uint16_t *		x1s
+)
+{
+	unsigned i, n = 0;
+
+	for( i=0 ; i<exclude_count ; i++ )
+	{
+		const struct overlay_rect * const r = exclude[i];
+		if( r->w == 0 || y < r->y || y >= r->y + r->h )
+			continue;
+
+		// Insertion sort on x0; there are only a few
+		unsigned j = n++;
+		for( ; j > 0 && x0s[j-1] > r->x ; j-- )
+		{
+			x0s[j] = x0s[j-1];
+			x1s[j] = x1s[j-1];
+		}
+
+		x0s[j] = r->x;
+		x1s[j] = r->x + r->w;
+	}
+
+	return n;
+}
+
+
+static void
+blit_image(
+	const struct bmp_image * image,
+	int			x,
+	int			y,
+	int			stencil,
+	uint8_t			color
+)
+{
+	uint8_t * const vram = bmp_vram();
+	const int pitch = bmp_pitch();
+	const int width = bmp_width();
+	const int height = bmp_height();
+	uint16_t x0s[ BLIT_MAX_EXCLUDE ];
+	uint16_t x1s[ BLIT_MAX_EXCLUDE ];
+	int iy;
+
+	if( !image || !vram || ( 1 & (uintptr_t) vram ) )
+		return;
+
+	for( iy=0 ; iy<image->height ; iy++ )
+	{
+		const int sy = y + iy;
+		if( sy < 0 )
+			continue;
+		if( sy >= height )
+			break;
+
+		const unsigned first = image->rows[iy];
+		const unsigned last = image->rows[iy+1];
+		if( first == last )
+			continue;
+
+		const uint8_t * const src = image->pixels + iy * image->pitch;
+		uint8_t * const dst = vram + sy * pitch;
+		const unsigned excluded = blit_row_exclude( sy, x0s, x1s );
+		unsigned r;
+
+		for( r=first ; r<last ; r++ )
+		{
+			int sx0 = x + image->runs[r].x;
+			int sx1 = sx0 + image->runs[r].len;
+			unsigned e;
+
+			if( sx0 < 0 )
+				sx0 = 0;
+			if( sx1 > width )
+				sx1 = width;
+
+			// Copy the parts of the run between the boxes
+			for( e=0 ; e<=excluded && sx0 < sx1 ; e++ )
+			{
+				int end = sx1;
+				if( e < excluded && x0s[e] < end )
+					end = x0s[e];
+
+				if( end > sx0 )
+				{
+					if( stencil )
+						span_fill( dst + sx0, end - sx0, color );
+					else
+						span_copy( dst + sx0, src + sx0 - x, end - sx0 );
+				}
+
+				if( e < excluded && x1s[e] > sx0 )
+					sx0 = x1s[e];
+			}
+		}
+	}
+}
+
+
+void
+bmp_blit(
+	const struct bmp_image * image,
+	int			x,
+	int			y
+)
+{
+	blit_image( image, x, y, 0, 0 );
+}
+
+
+void
+bmp_blit_color(
+	const struct bmp_image * image,
+	int			x,
+	int			y,
+	uint8_t			color
+)
+{
+	blit_image( image, x, y, 1, color );
+}
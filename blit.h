@@ -0,0 +1,123 @@
+#ifndef _blit_h_
+#define _blit_h_
+
+/** \file
+ * Transparent image blits into the BMP VRAM.
+ *
+ * An image is an 8-bit bitmap plus a run-length mask of its opaque
+ * pixels, built once when the image is made.  Blitting walks the
+ * runs of each row, clips them to the screen and to the excluded
+ * boxes, and copies what is left with span_copy(), so transparent
+ * pixels cost nothing and opaque ones are stored a word at a time.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "bmp.h"
+#include "overlay.h"
+
+#define BLIT_MAX_EXCLUDE	24
+
+
+/** One run of opaque pixels in a row of the image */
+struct blit_run
+{
+	uint16_t		x;
+	uint16_t		len;
+};
+
+
+struct bmp_image
+{
+	uint16_t		width;
+	uint16_t		height;
+	const uint8_t *		pixels;		//!< Top row
+	int			pitch;		//!< Bytes to the next row down
+
+	/** Row y has the runs from rows[y] up to rows[y+1] */
+	const uint32_t *	rows;
+	const struct blit_run *	runs;
+};
+
+
+/** Build the mask of an image; pixels equal to key are transparent.
+ * The pixels are not copied and must stay valid for the life of
+ * the image.  Returns NULL if out of memory.
+ */
+extern struct bmp_image *
+bmp_image_create(
+	const uint8_t *		pixels,
+	unsigned		width,
+	unsigned		height,
+	int			pitch,
+	uint8_t			key
+);
+
+
+/** Image of an 8-bit uncompressed BMP from bmp_load(), which must
+ * stay loaded.  Returns NULL if the pixels do not fit in the file.
+ */
+extern struct bmp_image *
+bmp_image_from_bmp(
+	const struct bmp_file_t * bmp,
+	uint8_t			key
+);
+
+
+extern void
+bmp_image_free(
+	struct bmp_image *	image
+);
+
+
+/** Draw the opaque pixels of the image with its top left corner at
+ * x, y, which may be off the screen.
+ */
+extern void
+bmp_blit(
+	const struct bmp_image * image,
+	int			x,
+	int			y
+);
+
+
+/** Draw the opaque pixels of the image in a single color, for
+ * stencils like cropmarks and icons.
+ */
+extern void
+bmp_blit_color(
+	const struct bmp_image * image,
+	int			x,
+	int			y,
+	uint8_t			color
+);
+
+
+/** Keep blits out of a box.  The box stays registered and is read
+ * on every blit, so its owner can move it; w == 0 turns it off.
+ * Returns 0 if there are too many boxes.
+ */
+extern int
+bmp_blit_exclude(
+	const struct overlay_rect * rect
+);
+
+#endif
@@ -27,8 +27,399 @@
 #include "dryos.h"
 #include "bmp.h"
 #include "font.h"
+#include "span.h"
 #include <stdarg.h>
 
+/** Only stubs-5d2.107.S and stubs-5d2.110.S have an address for
+ * this; it has not been found in 2.0.4 or 2.0.8, which is what the
+ * build ships.  There the mode is guessed from the LiveView buffer
+ * by bmp_hdmi_mode() instead.
+ */
+extern struct hdmi_config hdmi_config __attribute__((weak));
+
+/** HDMI modes from hdmi_config.hdmi_mode; 3 and up are 1080 */
+#define HDMI_MODE_1080		3
+
+/** Narrowest LiveView buffer seen on a 1080 HDMI output */
+#define HDMI_1080_VRAM_WIDTH	1920
+
+struct bmp_geometry bmp_geometry = {
+	.width		= 720,
+	.height		= 480,
+	.pitch		= 960,
+	.mode		= 0,
+};
+
+struct bmp_map bmp_map;
+
+
+static void
+bmp_geometry_update(
+	unsigned		mode
+)
+{
+	bmp_geometry.mode	= mode;
+	bmp_geometry.width	= mode >= HDMI_MODE_1080 ? 960 : 720;
+	bmp_geometry.height	= mode >= HDMI_MODE_1080 ? 540 : 480;
+}
+
+
+/** Nearest sample of a src sized axis for each of n positions */
+static void
+bmp_map_axis(
+	uint16_t *		map,
+	unsigned		n,
+	unsigned		src,
+	unsigned		max,
+	unsigned		even
+)
+{
+	// 16.16 step so that the loop only adds
+	const uint32_t step = (src << 16) / n;
+	uint32_t pos = step / 2;
+	unsigned i;
+
+	for( i=0 ; i<n ; i++, pos += step )
+	{
+		unsigned v = pos >> 16;
+		if( even )
+			v &= ~1;
+		map[i] = v > max ? max : v;
+	}
+}
+
+
+/** The HDMI mode, from hdmi_config where the stubs have it.
+ * Without it a full 1080 line LiveView buffer is only produced for a
+ * 1080 HDMI monitor, so take that as the mode; the 480 line modes
+ * all have the same 720x480 bitmap, so they need not be told apart.
+ */
+static unsigned
+bmp_hdmi_mode(
+	const struct vram_info *	vram
+)
+{
+	if( &hdmi_config )
+		return hdmi_config.hdmi_mode;
+
+	return vram->width >= HDMI_1080_VRAM_WIDTH ? HDMI_MODE_1080 : 0;
+}
+
+
+const struct bmp_map *
+bmp_map_update(
+	const struct vram_info *	vram
+)
+{
+	const unsigned mode = bmp_hdmi_mode( vram );
+	const unsigned width = vram->width;
+	const unsigned height = vram->height;
+
+	if( width < 2 || height < 2
+	||  width > BMP_MAP_VRAM_WIDTH
+	||  height > BMP_MAP_VRAM_HEIGHT )
+		return NULL;
+
+	if( bmp_map.generation
+	&&  mode == bmp_geometry.mode
+	&&  width == bmp_map.vram_width
+	&&  height == bmp_map.vram_height )
+		return &bmp_map;
+
+	bmp_geometry_update( mode );
+
+	const unsigned bw = bmp_geometry.width;
+	const unsigned bh = bmp_geometry.height;
+
+	// Columns stay on word boundaries; rows leave one below
+	bmp_map_axis( bmp_map.vram_x, bw, width, width - 2, 1 );
+	bmp_map_axis( bmp_map.vram_y, bh, height, height - 2, 0 );
+	bmp_map_axis( bmp_map.bmp_x, width, bw, bw - 1, 0 );
+	bmp_map_axis( bmp_map.bmp_y, height, bh, bh - 1, 0 );
+
+	bmp_map.vram_width	= width;
+	bmp_map.vram_height	= height;
+	bmp_map.bmp_width	= bw;
+	bmp_map.bmp_height	= bh;
+	bmp_map.generation++;
+
+	DebugMsg( DM_MAGIC, 3, "%s: vram %dx%d bmp %dx%d mode %d",
+		__func__,
+		width,
+		height,
+		bw,
+		bh,
+		mode
+	);
+
+	return &bmp_map;
+}
+
+
+/** Glyph cache.
+ *
+ * Each glyph is expanded the first time it is drawn in a given pair
+ * of colors into a full 8bpp cell, background included.  Drawing
+ * it again is then a row copy, a word at a time where the BMP row
+ * is aligned, and the cell is written in a single pass so that the
+ * text does not flash.
+ *
+ * The cache holds at most glyph_cache_slots cells and
+ * glyph_cache_bytes of pixels; the least recently used cell is
+ * dropped to make room.
+ */
+#define glyph_cache_slots	128
+#define glyph_cache_bytes	(64 * 1024)
+#define glyph_hash_size		64
+
+struct glyph
+{
+	const canon_char_t *	c;		//!< NULL if the slot is free
+	uint16_t		colors;		//!< bg << 8 | fg
+	uint16_t		width;
+	uint16_t		height;
+	uint16_t		next;		//!< Hash chain, or glyph_none
+	uint32_t		used;		//!< Tick of the last lookup
+	uint8_t *		pixels;		//!< width * height bytes
+};
+
+#define glyph_none		0xFFFF
+
+static struct semaphore *	glyph_sem;
+static struct glyph		glyphs[ glyph_cache_slots ];
+static uint16_t			glyph_hash[ glyph_hash_size ];
+static uint32_t			glyph_tick;
+static uint32_t			glyph_bytes;
+
+struct glyph_stats glyph_stats;
+
+
+static inline unsigned
+glyph_hash_key(
+	const canon_char_t *	c,
+	uint32_t		colors
+)
+{
+	const uint32_t k = ((uintptr_t) c >> 2) ^ (colors * 0x9E37);
+	return (k ^ (k >> 7)) % glyph_hash_size;
+}
+
+
+static void
+glyph_unlink(
+	unsigned		slot
+)
+{
+	struct glyph * const g = &glyphs[slot];
+	uint16_t * link = &glyph_hash[ glyph_hash_key( g->c, g->colors ) ];
+
+	while( *link != glyph_none && *link != slot )
+		link = &glyphs[ *link ].next;
+	if( *link == slot )
+		*link = g->next;
+
+	glyph_bytes -= g->width * g->height;
+	free( g->pixels );
+	g->pixels = NULL;
+	g->c = NULL;
+}
+
+
+/** Find a free slot, dropping the least recently used cells until
+ * there is a slot and room for size more bytes.
+ */
+static int
+glyph_alloc_slot(
+	uint32_t		size
+)
+{
+	while(1)
+	{
+		unsigned i;
+		int free_slot = -1;
+		int lru = -1;
+
+		for( i=0 ; i<glyph_cache_slots ; i++ )
+		{
+			if( !glyphs[i].c )
+			{
+				if( free_slot < 0 )
+					free_slot = i;
+				continue;
+			}
+
+			if( lru < 0 || glyphs[i].used < glyphs[lru].used )
+				lru = i;
+		}
+
+		if( free_slot >= 0 && glyph_bytes + size <= glyph_cache_bytes )
+			return free_slot;
+		if( lru < 0 )
+			return -1;
+
+		glyph_unlink( lru );
+		glyph_stats.evictions++;
+	}
+}
+
+
+/** Expand one glyph into an 8bpp cell of its display size */
+static void
+glyph_render(
+	const canon_font_t * const font,
+	const canon_char_t * const c,
+	struct glyph *		g,
+	uint8_t			fg_color,
+	uint8_t			bg_color
+)
+{
+	const uint8_t font_width = (c->width + 7) / 8;
+	const uint8_t * font_row = c->bitmap;
+	unsigned i;
+
+	// Margins around the bitmap; span_pattern() does the rest
+	span_fill( g->pixels, g->width * g->height, bg_color );
+
+	for( i=0 ; i < c->height && c->yoff + i < g->height ; i++ )
+	{
+		uint8_t * const row = &g->pixels[ (c->yoff + i) * g->width + c->xoff ];
+
+		span_pattern( row, font_row, c->width, fg_color, bg_color );
+		font_row += font_width;
+	}
+}
+
+
+static const struct glyph *
+glyph_lookup(
+	const canon_font_t * const font,
+	const canon_char_t * const c,
+	uint8_t			fg_color,
+	uint8_t			bg_color
+)
+{
+	const uint16_t colors = (bg_color << 8) | fg_color;
+	const unsigned key = glyph_hash_key( c, colors );
+	unsigned slot;
+
+	for( slot = glyph_hash[key] ; slot != glyph_none ; slot = glyphs[slot].next )
+	{
+		struct glyph * const g = &glyphs[slot];
+		if( g->c != c || g->colors != colors )
+			continue;
+
+		g->used = ++glyph_tick;
+		glyph_stats.hits++;
+		return g;
+	}
+
+	glyph_stats.misses++;
+
+	// The cell covers the display width and the font height, and
+	// the bitmap if it hangs out of them.
+	unsigned width = c->display_width;
+	unsigned height = font->height;
+	if( c->xoff + c->width > width )
+		width = c->xoff + c->width;
+	if( c->yoff + c->height > height )
+		height = c->yoff + c->height;
+
+	const uint32_t size = width * height;
+	if( size == 0 || size > glyph_cache_bytes )
+		return NULL;
+
+	const int free_slot = glyph_alloc_slot( size );
+	if( free_slot < 0 )
+		return NULL;
+
+	struct glyph * const g = &glyphs[ free_slot ];
+	g->pixels = malloc( size );
+	if( !g->pixels )
+		return NULL;
+
+	g->c		= c;
+	g->colors	= colors;
+	g->width	= width;
+	g->height	= height;
+	g->used		= ++glyph_tick;
+	glyph_render( font, c, g, fg_color, bg_color );
+
+	g->next		= glyph_hash[key];
+	glyph_hash[key]	= free_slot;
+	glyph_bytes	+= size;
+
+	return g;
+}
+
+
+/** Copy n bytes of a cell row into the BMP, whole words once the
+ * destination is aligned.
+ */
+static inline void
+glyph_copy_row(
+	uint8_t *		dst,
+	const uint8_t *		src,
+	unsigned		n
+)
+{
+	while( n && ((uintptr_t) dst & 3) )
+	{
+		*dst++ = *src++;
+		n--;
+	}
+
+	uint32_t * wdst = (uint32_t*) dst;
+	for( ; n >= 4 ; n -= 4, src += 4 )
+		*wdst++ = 0
+			| src[0] <<  0
+			| src[1] <<  8
+			| src[2] << 16
+			| src[3] << 24;
+
+	dst = (uint8_t*) wdst;
+	while( n-- )
+		*dst++ = *src++;
+}
+
+
+/** Draw the glyph straight from the font, without the cache.
+ * Each pixel is still written once.
+ */
+static void
+canon_char_draw_direct(
+	const canon_font_t * const font,
+	const canon_char_t * const c,
+	uint8_t			fg_color,
+	uint8_t			bg_color,
+	uint8_t *		bmp_vram_row
+)
+{
+	const uint32_t	pitch		= bmp_pitch();
+	const uint8_t	font_width	= (c->width + 7) / 8;
+	unsigned i, j;
+
+	for( i=0 ; i < font->height ; i++ )
+	{
+		uint8_t * const row = bmp_vram_row + i * pitch;
+		const int gy = (int) i - c->yoff;
+		const uint8_t * const font_row = gy >= 0 && gy < c->height
+			? c->bitmap + gy * font_width
+			: NULL;
+
+		for( j=0 ; j < c->display_width ; j++ )
+		{
+			const int gx = (int) j - c->xoff;
+			uint8_t color = bg_color;
+
+			if( font_row && gx >= 0 && gx < c->width
+			&&  (font_row[gx / 8] & (0x80 >> (gx % 8))) )
+				color = fg_color;
+
+			row[j] = color;
+		}
+	}
+}
+
 
 static void
 canon_char_draw(
@@ -51,51 +442,84 @@ canon_char_draw(
 		bg_color = COLOR_BG;
 	}
 
-	const uint32_t	pitch		= bmp_pitch();
-	uint8_t *	draw_row	= bmp_vram_row;
-
-	//uint32_t flags = cli();
-	unsigned i, j;
-
-	// Fill in the background entirely
-	// \todo: Do this right; it causes flashing
-	for( i=0 ; i < font->height ; i++)
+	// Too early for the cache
+	if( !glyph_sem )
 	{
-		uint8_t * row = draw_row;
-		for( j=0 ; j < c->display_width ; j++)
-			*row++ = bg_color;
-		draw_row += pitch;
+		canon_char_draw_direct( font, c, fg_color, bg_color, bmp_vram_row );
+		return;
 	}
 
-	// Adjust by the offsets in the character
-	// and draw it over the now-cleared background.
-	draw_row = bmp_vram_row + c->xoff + c->yoff * pitch;
+	const uint32_t pitch = bmp_pitch();
+	unsigned i;
 
-	const uint8_t * font_row = c->bitmap;
-	const uint8_t font_width = (c->width + 7) / 8;
+	take_semaphore( glyph_sem, 0 );
 
-	for( i=0 ; i < c->height ; i++)
+	const struct glyph * const g = glyph_lookup( font, c, fg_color, bg_color );
+	if( g )
 	{
-		// Start this scanline
-		uint8_t * row = draw_row;
+		const uint8_t * src = g->pixels;
+		for( i=0 ; i < g->height ; i++, src += g->width )
+			glyph_copy_row( bmp_vram_row + i * pitch, src, g->width );
+	} else
+		canon_char_draw_direct( font, c, fg_color, bg_color, bmp_vram_row );
 
-		// Need to account for other width
-		for( j=0 ; j < c->width ; j++)
-		{
-			uint8_t pixel = font_row[j / 8];
-			pixel &= 0x80 >> (j % 8);
-			
-			*row++ = pixel ? fg_color : bg_color;
-		}
+	give_semaphore( glyph_sem );
+}
 
-		font_row += font_width;
-		draw_row += pitch;
-	}
+
+/** Per-font index of the charmap.
+ *
+ * The ROM fonts have an ASCII table at the start of the charmap and
+ * the rest of the characters after it in no useful order.  The
+ * index has a direct pointer for every printable ASCII character
+ * and an open addressed hash over the whole charmap, so that every
+ * lookup is a couple of probes.  It is built once per font at init.
+ */
+#define font_index_fonts	8
+#define font_index_ascii	0x60
+
+struct font_index
+{
+	const canon_font_t *	font;
+	const uint32_t *	charmap;
+	const uint32_t *	offsets;
+	const uint8_t *		chars;
+	uint32_t		bits;		//!< log2 of the hash size
+	uint16_t *		slots;		//!< Charmap index + 1, 0 is empty
+	const canon_char_t *	ascii[ font_index_ascii ];
+};
+
+static struct font_index	font_indices[ font_index_fonts ];
+static unsigned			font_index_count;
+
+
+static inline uint32_t
+font_index_hash(
+	uint32_t		c,
+	uint32_t		bits
+)
+{
+	return (c * 0x9E3779B1) >> (32 - bits);
+}
+
+
+/** Character at charmap offset, or NULL if it is out of the bitmap */
+static inline const canon_char_t *
+font_char_at(
+	const canon_font_t * const font,
+	const uint8_t *		chars,
+	uint32_t		offset
+)
+{
+	if (offset > font->bitmap_size)
+		return NULL;
+
+	return (const void*)(chars + offset);
 }
 
 
 static const canon_char_t *
-canon_char_lookup(
+canon_char_search(
 	const canon_font_t * const font,
 	uint32_t c
 )
@@ -140,12 +564,145 @@ canon_char_lookup(
 		}
 	}
 
-	if (offset > font->bitmap_size)
+	return font_char_at( font, chars, offset );
+}
+
+
+/** Build the index for one font.  Fonts with a bad header or too
+ * many characters are left to the linear search.
+ */
+static void
+font_index_build(
+	const canon_font_t * const font
+)
+{
+	if( font_index_count >= font_index_fonts )
+		return;
+	if( font->magic != CANON_FONT_MAGIC )
+		return;
+
+	const uint32_t count = font->charmap_size / 4;
+	if( count == 0 || count >= 0xFFFF )
+		return;
+
+	// At most half full
+	uint32_t bits = 1;
+	while( (1u << bits) < 2 * count )
+		bits++;
+
+	uint16_t * const slots = malloc( sizeof(*slots) << bits );
+	if( !slots )
+		return;
+
+	struct font_index * const index = &font_indices[ font_index_count ];
+	const uint8_t * const hdr_end
+		= font->charmap_offset + (const uint8_t*) font;
+	const uint32_t mask = (1u << bits) - 1;
+	uint32_t i;
+
+	index->font	= font;
+	index->charmap	= (const void*)(hdr_end);
+	index->offsets	= (const void*)(hdr_end + font->charmap_size);
+	index->chars	= (const void*)(hdr_end + 2 * font->charmap_size);
+	index->bits	= bits;
+	index->slots	= slots;
+
+	for( i=0 ; i<=mask ; i++ )
+		slots[i] = 0;
+
+	for( i=0 ; i<count ; i++ )
+	{
+		const uint32_t c = index->charmap[i];
+		uint32_t h = font_index_hash( c, bits );
+
+		// Keep the first entry for a character, like the search
+		while( slots[h] && index->charmap[ slots[h] - 1 ] != c )
+			h = (h + 1) & mask;
+		if( !slots[h] )
+			slots[h] = i + 1;
+	}
+
+	for( i=0 ; i<font_index_ascii ; i++ )
+		index->ascii[i] = canon_char_search( font, i + 0x20 );
+
+	font_index_count++;
+}
+
+
+static const canon_char_t *
+canon_char_lookup(
+	const canon_font_t * const font,
+	uint32_t c
+)
+{
+	unsigned i;
+
+	for( i=0 ; i<font_index_count ; i++ )
+	{
+		const struct font_index * const index = &font_indices[i];
+		if( index->font != font )
+			continue;
+
+		if( 0x20 <= c && c < 0x20 + font_index_ascii )
+			return index->ascii[ c - 0x20 ];
+
+		const uint32_t mask = (1u << index->bits) - 1;
+		uint32_t h = font_index_hash( c, index->bits );
+		uint32_t slot;
+
+		while( (slot = index->slots[h]) )
+		{
+			if( index->charmap[ slot - 1 ] == c )
+				return font_char_at( font, index->chars, index->offsets[ slot - 1 ] );
+			h = (h + 1) & mask;
+		}
+
 		return NULL;
+	}
 
-	const canon_char_t * const cc = (const void*)(chars + offset);
+	// Not indexed yet
+	return canon_char_search( font, c );
+}
 
-	return cc;
+
+/** Decode one UTF-8 character and advance the string past it.
+ * Bytes that do not start a valid sequence are taken as Latin-1,
+ * so older strings with single byte symbols still print.
+ */
+static uint32_t
+utf8_next(
+	const char **		sp
+)
+{
+	const uint8_t * s = (const uint8_t*) *sp;
+	const uint32_t first = *s++;
+	unsigned extra;
+	uint32_t c;
+
+	if( first < 0x80 )
+		extra = 0, c = first;
+	else if( (first & 0xE0) == 0xC0 )
+		extra = 1, c = first & 0x1F;
+	else if( (first & 0xF0) == 0xE0 )
+		extra = 2, c = first & 0x0F;
+	else if( (first & 0xF8) == 0xF0 )
+		extra = 3, c = first & 0x07;
+	else
+		goto latin1;
+
+	for( ; extra ; extra-- )
+	{
+		if( (*s & 0xC0) != 0x80 )
+			goto latin1;
+		c = (c << 6) | (*s++ & 0x3F);
+	}
+
+	*sp = (const char*) s;
+	return c;
+
+latin1:
+	*sp += 1;
+	return first;
 }
 
 
@@ -186,10 +743,10 @@ bmp_puts(
 	const canon_font_t * const font = fontspec_font( fontspec );
 	const canon_char_t * const space = canon_char_lookup(font, ' ');
 
-	// \todo: Handle UTF8 correctly
-	char c;
-	while( (c = *s++) )
+	while( *s )
 	{
+		const uint32_t c = utf8_next( &s );
+
 		if( c == '\n' )
 		{
 			row = first_row += pitch * space->height;
@@ -230,6 +787,230 @@ bmp_printf(
 }
 
 
+/** Retained text cells.
+ *
+ * Status text is mostly printed again unchanged.  A cell remembers
+ * the last string drawn at an x, y position in one font, its hash
+ * and a checksum of the middle row of pixels as drawn.  If the
+ * string and the pixels are the same nothing is drawn; otherwise
+ * only the glyphs that changed or moved are drawn.  The checksum
+ * catches anything else that drew over the cell, and then the
+ * whole string is drawn.
+ *
+ * Like bmp_puts, a shorter string does not clear the end of the
+ * previous one.
+ */
+#define text_cell_count		48
+#define text_cell_len		48
+
+struct text_cell
+{
+	const uint8_t *		vram;		//!< NULL if the cell is free
+	uint16_t		x;
+	uint16_t		y;
+	uint32_t		fontspec;
+	uint32_t		hash;		//!< Of text
+	uint32_t		check;		//!< Of the middle row
+	uint16_t		width;		//!< Pixels drawn
+	uint32_t		used;
+	char			text[ text_cell_len ];
+};
+
+static struct semaphore *	text_cell_sem;
+static struct text_cell		text_cells[ text_cell_count ];
+static uint32_t			text_cell_tick;
+
+struct text_cell_stats text_cell_stats;
+
+
+static uint32_t
+text_cell_hash(
+	const char *		s
+)
+{
+	uint32_t hash = 0x811C9DC5;
+	while( *s )
+		hash = (hash ^ (uint8_t) *s++) * 0x01000193;
+	return hash;
+}
+
+
+static uint32_t
+text_cell_check(
+	const uint8_t *		row,
+	unsigned		width
+)
+{
+	uint32_t check = width;
+	unsigned i;
+
+	for( i=0 ; i<width ; i++ )
+		check = ((check << 1) | (check >> 31)) ^ row[i];
+	return check;
+}
+
+
+/** Cell at x, y in this font, or the least recently used one with
+ * vram cleared.
+ */
+static struct text_cell *
+text_cell_find(
+	const uint8_t *		vram,
+	unsigned		x,
+	unsigned		y,
+	unsigned		fontspec
+)
+{
+	struct text_cell * lru = &text_cells[0];
+	unsigned i;
+
+	for( i=0 ; i<text_cell_count ; i++ )
+	{
+		struct text_cell * const cell = &text_cells[i];
+		if( cell->vram == vram
+		&&  cell->x == x
+		&&  cell->y == y
+		&&  cell->fontspec == fontspec )
+			return cell;
+		if( !cell->vram )
+			lru = cell, lru->used = 0;
+		else if( cell->used < lru->used )
+			lru = cell;
+	}
+
+	lru->vram	= NULL;
+	lru->x		= x;
+	lru->y		= y;
+	lru->fontspec	= fontspec;
+	return lru;
+}
+
+
+/** Width of the pixels a glyph writes, which may be more than its
+ * display width.
+ */
+static inline unsigned
+glyph_extent(
+	const canon_char_t * const cc
+)
+{
+	const unsigned extent = cc->xoff + cc->width;
+	return extent > cc->display_width ? extent : cc->display_width;
+}
+
+
+void
+bmp_cell_puts(
+	unsigned		fontspec,
+	unsigned		x,
+	unsigned		y,
+	const char *		s
+)
+{
+	const uint32_t		pitch = bmp_pitch();
+	uint8_t * const vram = bmp_vram();
+	const char * p;
+
+	for( p = s ; *p && *p != '\n' ; p++ )
+		;
+
+	if( !text_cell_sem
+	||  !vram || ((uintptr_t)vram & 1) == 1
+	||  *p || p - s >= text_cell_len )
+	{
+		bmp_puts( fontspec, &x, &y, s );
+		return;
+	}
+
+	const canon_font_t * const font = fontspec_font( fontspec );
+	const uint32_t hash = text_cell_hash( s );
+	uint8_t * const row = vram + y * pitch + x;
+	uint8_t * const check_row = row + (font->height / 2) * pitch;
+
+	take_semaphore( text_cell_sem, 0 );
+	text_cell_stats.prints++;
+
+	struct text_cell * const cell = text_cell_find( vram, x, y, fontspec );
+	const int valid = cell->vram
+		&& cell->check == text_cell_check( check_row, cell->width );
+
+	if( valid && cell->hash == hash && streq( cell->text, s ) )
+	{
+		cell->used = ++text_cell_tick;
+		text_cell_stats.skipped++;
+		goto done;
+	}
+
+	// Walk the old string alongside the new one; a glyph is kept
+	// if the same character is already at the same position.
+	const char * old = valid ? cell->text : "";
+	uint32_t old_c = *old ? utf8_next( &old ) : 0;
+	unsigned old_x = 0;
+	unsigned new_x = 0;
+	int overhang = 0;
+
+	for( p = s ; *p ; )
+	{
+		const uint32_t c = utf8_next( &p );
+		const canon_char_t * const cc = canon_char_lookup( font, c );
+		if( !cc )
+			continue;
+
+		while( old_c && old_x < new_x )
+		{
+			const canon_char_t * const oc = canon_char_lookup( font, old_c );
+			if( oc )
+				old_x += oc->display_width;
+			old_c = *old ? utf8_next( &old ) : 0;
+		}
+
+		if( !overhang && old_c == c && old_x == new_x )
+		{
+			text_cell_stats.kept++;
+		} else {
+			canon_char_draw( font, cc, fontspec, row + new_x );
+			text_cell_stats.drawn++;
+
+			// The next glyph may have been drawn over
+			overhang = glyph_extent( cc ) > cc->display_width;
+		}
+
+		new_x += cc->display_width;
+	}
+
+	strcpy( cell->text, s );
+	cell->vram	= vram;
+	cell->fontspec	= fontspec;
+	cell->hash	= hash;
+	cell->width	= new_x;
+	cell->check	= text_cell_check( check_row, new_x );
+	cell->used	= ++text_cell_tick;
+
+done:
+	give_semaphore( text_cell_sem );
+}
+
+
+void
+bmp_cell_printf(
+	unsigned		fontspec,
+	unsigned		x,
+	unsigned		y,
+	const char *		fmt,
+	...
+)
+{
+	va_list			ap;
+	char			buf[ 256 ];
+
+	va_start( ap, fmt );
+	vsnprintf( buf, sizeof(buf), fmt, ap );
+	va_end( ap );
+
+	bmp_cell_puts( fontspec, x, y, buf );
+}
+
+
 void
 con_printf(
 	unsigned		fontspec,
@@ -332,8 +1113,8 @@ bmp_hexdump(
 }
 
 
-/** Fill a section of bitmap memory with solid color
- * Only has a four-pixel resolution in X.
+/** Fill a section of bitmap memory with solid color, clipped to
+ * the screen.
  */
 void
 bmp_fill(
@@ -344,54 +1125,24 @@ bmp_fill(
 	uint32_t		h
 )
 {
-	const uint32_t start = x;
 	const uint32_t width = bmp_width();
 	const uint32_t pitch = bmp_pitch();
 	const uint32_t height = bmp_height();
 
-	// Convert to words and limit to the width of the LCD
-	if( start + w > width )
-		w = width - start;
-	
-	const uint32_t word = 0
-		| (color << 24)
-		| (color << 16)
-		| (color <<  8)
-		| (color <<  0);
-
-	if( y > height )
-		y = height;
-
-	uint16_t y_end = y + h;
-	if( y_end > height )
-		y_end = height;
-
-	if( w == 0 || h == 0 )
+	if( x >= width || y >= height )
 		return;
+	if( w > width - x )
+		w = width - x;
+	if( h > height - y )
+		h = height - y;
 
 	uint8_t * const vram = bmp_vram();
-	uint32_t * row = (void*)( vram + y * pitch + start );
-
 	if( !vram || ( 1 & (uintptr_t) vram ) )
-	{
-		//sei( flags );
 		return;
-	}
-
 
-	for( ; y<y_end ; y++, row += pitch/4 )
-	{
-		uint32_t x;
-
-		for( x=0 ; x<w/4 ; x++ )
-		{
-			row[ x ] = word;
-			asm( "nop" );
-			asm( "nop" );
-			asm( "nop" );
-			asm( "nop" );
-		}
-	}
+	uint8_t * row = vram + y * pitch + x;
+	for( ; h ; h--, row += pitch )
+		span_fill( row, w, color );
 }
 
 
@@ -399,7 +1150,7 @@ bmp_fill(
 void
 bmp_draw_palette( void )
 {
-	uint32_t x, y, msb, lsb;
+	uint32_t y, msb, lsb;
 	const uint32_t height = 30;
 	const uint32_t width = 45;
 
@@ -410,10 +1161,7 @@ bmp_draw_palette( void )
 			uint8_t * const row = bmp_vram() + (y + height*msb) * bmp_pitch();
 
 			for( lsb=0 ; lsb<16 ; lsb++ )
-			{
-				for( x=0 ; x<width ; x++ )
-					row[x+width*lsb] = (msb << 4) | lsb;
-			}
+				span_fill( row + width*lsb, width, (msb << 4) | lsb );
 		}
 	}
 
@@ -512,6 +1260,10 @@ bmp_load(
 	memcpy(fast_buf, buf, size);
 	bmp = (struct bmp_file_t *) fast_buf;
 	bmp->image = fast_buf + image_offset;
+
+	// The header size may be wrong; record what is really there
+	bmp->size = size;
+
 	free_dma_memory( buf );
 
 	return bmp;
@@ -525,3 +1277,24 @@ malloc_fail:
 getfilesize_fail:
 	return NULL;
 }
+
+
+static void
+bmp_init( void * unused )
+{
+	unsigned i;
+	for( i=0 ; i<glyph_hash_size ; i++ )
+		glyph_hash[i] = glyph_none;
+
+	font_index_build( &font_small );
+	font_index_build( &font_med );
+	font_index_build( &font_mono_24 );
+	font_index_build( &font_gothic_24 );
+	font_index_build( &font_gothic_30 );
+	font_index_build( &font_gothic_36 );
+
+	glyph_sem = create_named_semaphore( "glyph", 1 );
+	text_cell_sem = create_named_semaphore( "text_cell", 1 );
+}
+
+INIT_FUNC( __FILE__, bmp_init );
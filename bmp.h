@@ -39,13 +39,65 @@ bmp_vram(void)
 }
 
 
+/** Largest BMP and LiveView geometry that the maps cover */
+#define BMP_MAX_WIDTH		960
+#define BMP_MAX_HEIGHT		540
+#define BMP_MAP_VRAM_WIDTH	2048
+#define BMP_MAP_VRAM_HEIGHT	1088
+
+
+/** Active area of the BMP vram for the current display mode.
+ * The LCD and SD outputs use 720x480; HDMI 1080 uses the whole
+ * 960x540.  The pitch is always 960.
+ */
+struct bmp_geometry
+{
+	uint32_t		width;
+	uint32_t		height;
+	uint32_t		pitch;
+	uint32_t		mode;		//!< hdmi_config.hdmi_mode
+};
+
+extern struct bmp_geometry bmp_geometry;
+
 /** Returns the width, pitch and height of the BMP vram.
- * These should check the current mode since we might be in
- * HDMI output mode, which uses the full 960x540 space.
+ * They follow the display mode as of the last bmp_map_update().
+ */
+static inline uint32_t bmp_width(void) { return bmp_geometry.width; }
+static inline uint32_t bmp_pitch(void) { return bmp_geometry.pitch; }
+static inline uint32_t bmp_height(void) { return bmp_geometry.height; }
+
+
+/** Mapping between LiveView VRAM and BMP coordinates.
+ *
+ * The BMP to VRAM columns are always even, so that vram_x[x] / 2 is
+ * the UYVY word that holds the pixel, and the rows leave room for
+ * the row below.
  */
-static inline uint32_t bmp_width(void) { return 720; }
-static inline uint32_t bmp_pitch(void) { return 960; }
-static inline uint32_t bmp_height(void) { return 480; }
+struct bmp_map
+{
+	uint32_t		generation;	//!< Incremented on every rebuild
+	uint32_t		vram_width;
+	uint32_t		vram_height;
+	uint32_t		bmp_width;
+	uint32_t		bmp_height;
+	uint16_t		vram_x[ BMP_MAX_WIDTH ];	//!< BMP to VRAM
+	uint16_t		vram_y[ BMP_MAX_HEIGHT ];
+	uint16_t		bmp_x[ BMP_MAP_VRAM_WIDTH ];	//!< VRAM to BMP
+	uint16_t		bmp_y[ BMP_MAP_VRAM_HEIGHT ];
+};
+
+extern struct bmp_map bmp_map;
+
+
+/** Check the display mode and the LiveView size and rebuild the
+ * BMP geometry and the maps if either changed.  Returns the map,
+ * or NULL if the LiveView geometry is not usable.
+ */
+extern const struct bmp_map *
+bmp_map_update(
+	const struct vram_info *	vram
+);
 
 /** Font specifiers include the font, the fg color and bg color */
 #define FONT_MASK		0x00FF0000
@@ -112,6 +164,17 @@ fontspec_height(
 }
 
 
+/** Glyph cache counters, for the debug menu */
+struct glyph_stats
+{
+	uint32_t		hits;
+	uint32_t		misses;
+	uint32_t		evictions;
+};
+
+extern struct glyph_stats glyph_stats;
+
+
 extern void
 bmp_printf(
 	unsigned		fontspec,
@@ -146,13 +209,45 @@ bmp_puts(
 	const char *		s
 );
 
+
+/** Retained text: draw only the glyphs that differ from the last
+ * string drawn at the same x, y.  Strings with newlines and long
+ * strings are drawn with bmp_puts.
+ */
+extern void
+bmp_cell_puts(
+	unsigned		fontspec,
+	unsigned		x,
+	unsigned		y,
+	const char *		s
+);
+
+extern void
+bmp_cell_printf(
+	unsigned		fontspec,
+	unsigned		x,
+	unsigned		y,
+	const char *		fmt,
+	...
+) __attribute__((format(printf,4,5)));
+
+struct text_cell_stats
+{
+	uint32_t		prints;
+	uint32_t		skipped;	//!< Whole strings not drawn
+	uint32_t		drawn;		//!< Glyphs drawn
+	uint32_t		kept;		//!< Glyphs not drawn
+};
+
+extern struct text_cell_stats text_cell_stats;
+
 /** Fill the screen with a bitmap palette */
 extern void
 bmp_draw_palette( void );
 
 
-/** Fill a section of bitmap memory with solid color
- * Only has a four-pixel resolution in X.
+/** Fill a section of bitmap memory with solid color.
+ * Clipped to the screen; any x and width.
  */
 extern void
 bmp_fill(
@@ -212,10 +307,22 @@ struct bmp_file_t
 
 SIZE_CHECK_STRUCT( bmp_file_t, 54 );
 
+/** Load a whole BMP file.  image points into the returned buffer
+ * and size is the number of bytes that were read.  free() it when
+ * done.
+ */
 extern struct bmp_file_t *
 bmp_load(
 	const char *		name
 );
 
+/** Read a whole file; returns size or -1 on a short read */
+extern size_t
+read_file(
+	const char *		filename,
+	void *			buf,
+	size_t			size
+);
+
 
 #endif
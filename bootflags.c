@@ -70,7 +70,7 @@ bootflag_display(
 	int			selected
 )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -158,7 +158,7 @@ powersave_display(
 	int			selected
 )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x,
 		y,
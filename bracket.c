@@ -30,7 +30,7 @@ ae_display(
 	int			selected
 )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//2349012
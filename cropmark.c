@@ -0,0 +1,459 @@
+/** \file
+ * Cropmark decoder, card cache and overlay hook.
+ *
+ * The BMP is streamed through a one row buffer and turned into runs
+ * of identical non-transparent pixel pairs.  The runs of each screen
+ * row are contiguous and sorted by x, so the overlay span layer draws
+ * a row by filling each of its runs in turn.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "bmp.h"
+#include "span.h"
+#include "cropmark.h"
+
+/** Largest BMP row that the decoder will stream */
+#define CROPMARK_MAX_WIDTH	1024
+
+/** Scratch space for the decoder; more runs than this is not a
+ * cropmark, it is a photograph.
+ */
+#define CROPMARK_MAX_SPANS	4096
+
+/** Bytes at the start of the BMP that the cache is keyed on; the
+ * header, the palette and the first rows of an 8-bit BMP.
+ */
+#define CROPMARK_SUM_BYTES	4096
+
+/** Alternate pixels, for the pairs with two different colors */
+static const uint8_t cropmark_pair_bits[ CROPMARK_MAX_WIDTH / 8 ] = {
+	[ 0 ... CROPMARK_MAX_WIDTH / 8 - 1 ] = 0xAA,
+};
+
+
+/** Files that have already been loaded, so that switching between
+ * them does not touch the card.
+ */
+struct cropmark_entry
+{
+	struct cropmark_entry *	next;
+	const struct cropmark *	crop;
+	char			name[ 64 ];
+};
+
+static struct cropmark_entry * cropmark_list;
+
+
+/** Fletcher checksum of the first CROPMARK_SUM_BYTES of the file.
+ * The directory listing with the timestamps is not in the stubs of
+ * every firmware, so the file is keyed on its contents instead.
+ * Returns 0 if the file can not be read.
+ */
+static uint32_t
+cropmark_file_sum(
+	const char *		filename,
+	unsigned		bmp_size
+)
+{
+	uint32_t a = 1;
+	uint32_t b = 0;
+
+	uint8_t * buf = alloc_dma_memory( CROPMARK_MAX_WIDTH );
+	if( !buf )
+		return 0;
+
+	FILE * file = FIO_Open( filename, O_RDONLY | O_SYNC );
+	if( file == INVALID_PTR )
+	{
+		free_dma_memory( buf );
+		return 0;
+	}
+
+	unsigned left = bmp_size < CROPMARK_SUM_BYTES ? bmp_size : CROPMARK_SUM_BYTES;
+	while( left )
+	{
+		const unsigned len = left < CROPMARK_MAX_WIDTH ? left : CROPMARK_MAX_WIDTH;
+		if( FIO_ReadFile( file, buf, len ) != (ssize_t) len )
+		{
+			b = a = 0;
+			break;
+		}
+
+		unsigned i;
+		for( i=0 ; i<len ; i++ )
+		{
+			a = (a + buf[i]) & 0xFFFF;
+			b = (b + a) & 0xFFFF;
+		}
+
+		left -= len;
+	}
+
+	FIO_CloseFile( file );
+	free_dma_memory( buf );
+	return (b << 16) | a;
+}
+
+
+/** Build the cache file name: the BMP name with a .crs extension */
+static void
+cropmark_cache_name(
+	char *			buf,
+	size_t			len,
+	const char *		filename
+)
+{
+	snprintf( buf, len, "%s", filename );
+
+	char * dot = 0;
+	char * p;
+	for( p = buf ; *p ; p++ )
+		if( *p == '.' )
+			dot = p;
+		else
+		if( *p == '/' )
+			dot = 0;
+
+	if( !dot )
+		dot = p;
+	if( dot + 4 < buf + len )
+		strcpy( dot, ".crs" );
+}
+
+
+static inline size_t
+cropmark_size(
+	unsigned		count
+)
+{
+	return sizeof(struct cropmark) + count * sizeof(struct cropmark_span);
+}
+
+
+/** Read a cached decode if it matches the BMP size and checksum */
+static struct cropmark *
+cropmark_read_cache(
+	const char *		cache_name,
+	uint32_t		bmp_size,
+	uint32_t		bmp_sum
+)
+{
+	unsigned size;
+	if( FIO_GetFileSize( cache_name, &size ) != 0 )
+		return NULL;
+	if( size < sizeof(struct cropmark) )
+		return NULL;
+
+	uint8_t * buf = alloc_dma_memory( size );
+	if( !buf )
+		return NULL;
+
+	struct cropmark * crop = NULL;
+	const struct cropmark * cached = (const struct cropmark *) buf;
+
+	if( read_file( cache_name, buf, size ) != size )
+		goto done;
+	if( cached->magic != CROPMARK_MAGIC
+	||  cached->bmp_size != bmp_size
+	||  cached->bmp_sum != bmp_sum
+	||  cropmark_size( cached->count ) != size
+	||  cached->rows[ CROPMARK_ROWS ] != cached->count )
+		goto done;
+
+	// Copy out of the uncacheable read buffer
+	crop = malloc( size );
+	if( crop )
+		memcpy( crop, buf, size );
+
+done:
+	free_dma_memory( buf );
+	return crop;
+}
+
+
+static void
+cropmark_write_cache(
+	const char *		cache_name,
+	const struct cropmark *	crop
+)
+{
+	FILE * file = FIO_CreateFile( cache_name );
+	if( file == INVALID_PTR )
+		return;
+
+	FIO_WriteFile( file, crop, cropmark_size( crop->count ) );
+	FIO_CloseFile( file );
+}
+
+
+/** Turn one BMP row into runs of identical non-zero pixel pairs */
+static unsigned
+cropmark_decode_row(
+	struct cropmark_span *	spans,
+	unsigned		count,
+	const uint8_t *		row,
+	unsigned		width,
+	unsigned		y
+)
+{
+	unsigned x;
+	for( x=0 ; x+1<width ; x += 2 )
+	{
+		const uint16_t color = row[x] | (row[x+1] << 8);
+		if( color == 0 )
+			continue;
+
+		// Extend the previous run on this row if it touches
+		if( count
+		&&  spans[count-1].y == y
+		&&  spans[count-1].x1 == x
+		&&  spans[count-1].color == color
+		) {
+			spans[count-1].x1 = x + 2;
+			continue;
+		}
+
+		if( count == CROPMARK_MAX_SPANS )
+			return count + 1;
+
+		spans[count].y		= y;
+		spans[count].x0		= x;
+		spans[count].x1		= x + 2;
+		spans[count].color	= color;
+		count++;
+	}
+
+	return count;
+}
+
+
+/** Stream the BMP from the card and decode it into spans */
+static struct cropmark *
+cropmark_decode(
+	const char *		filename,
+	uint32_t		bmp_size,
+	uint32_t		bmp_sum
+)
+{
+	struct cropmark * crop = NULL;
+	struct cropmark_span * spans = NULL;
+	unsigned count = 0;
+
+	uint8_t * buf = alloc_dma_memory( CROPMARK_MAX_WIDTH );
+	if( !buf )
+		return NULL;
+
+	FILE * file = FIO_Open( filename, O_RDONLY | O_SYNC );
+	if( file == INVALID_PTR )
+		goto open_fail;
+
+	struct bmp_file_t * bmp = (struct bmp_file_t *) buf;
+	if( FIO_ReadFile( file, buf, sizeof(*bmp) ) != sizeof(*bmp) )
+		goto read_fail;
+
+	const unsigned image_offset	= (unsigned) bmp->image;
+	const unsigned width		= bmp->width;
+	const unsigned height		= bmp->height;
+	const unsigned stride		= (width + 3) & ~3;
+
+	if( bmp->signature != 0x4D42
+	||  bmp->bits_per_pixel != 8
+	||  bmp->compression != 0
+	||  stride > CROPMARK_MAX_WIDTH
+	||  image_offset < sizeof(*bmp)
+	||  image_offset + stride * height > bmp_size
+	) {
+		DebugMsg( DM_MAGIC, 3, "%s: not an 8-bit BMP (%dx%d @ %d)",
+			filename,
+			width,
+			height,
+			bmp->bits_per_pixel
+		);
+		goto read_fail;
+	}
+
+	// Skip the palette; there is no seek
+	unsigned offset = sizeof(*bmp);
+	while( offset < image_offset )
+	{
+		unsigned len = image_offset - offset;
+		if( len > CROPMARK_MAX_WIDTH )
+			len = CROPMARK_MAX_WIDTH;
+		if( FIO_ReadFile( file, buf, len ) != (ssize_t) len )
+			goto read_fail;
+		offset += len;
+	}
+
+	spans = malloc( CROPMARK_MAX_SPANS * sizeof(*spans) );
+	if( !spans )
+		goto read_fail;
+
+	// The rows are stored bottom up.  Only the pairs that fit on
+	// the screen are kept.
+	const unsigned draw_width = width < 720 ? width : 720;
+	unsigned row;
+	for( row=0 ; row<height ; row++ )
+	{
+		if( FIO_ReadFile( file, buf, stride ) != (ssize_t) stride )
+			goto read_fail;
+
+		const unsigned y = height - row;
+		if( y >= CROPMARK_ROWS )
+			continue;
+
+		count = cropmark_decode_row( spans, count, buf, draw_width, y );
+		if( count > CROPMARK_MAX_SPANS )
+		{
+			DebugMsg( DM_MAGIC, 3, "%s: too many spans", filename );
+			goto read_fail;
+		}
+	}
+
+	crop = malloc( cropmark_size( count ) );
+	if( !crop )
+		goto read_fail;
+
+	crop->magic	= CROPMARK_MAGIC;
+	crop->bmp_size	= bmp_size;
+	crop->bmp_sum	= bmp_sum;
+	crop->count	= count;
+
+	// Sort the rows top down.  Each row is already one contiguous
+	// block sorted by x, so only the blocks need to be moved.
+	unsigned i;
+	for( i=0 ; i<COUNT(crop->rows) ; i++ )
+		crop->rows[i] = 0;
+	for( i=0 ; i<count ; i++ )
+		crop->rows[ spans[i].y + 1 ]++;
+	for( i=0 ; i<CROPMARK_ROWS ; i++ )
+		crop->rows[i+1] += crop->rows[i];
+
+	unsigned block = 0;
+	for( i=0 ; i<count ; i++ )
+	{
+		if( spans[i].y != spans[block].y )
+			block = i;
+		crop->spans[ crop->rows[ spans[i].y ] + i - block ] = spans[i];
+	}
+
+	DebugMsg( DM_MAGIC, 3, "%s: %dx%d, %d spans, %d bytes",
+		filename,
+		width,
+		height,
+		count,
+		cropmark_size( count )
+	);
+
+read_fail:
+	if( spans )
+		free( spans );
+	FIO_CloseFile( file );
+open_fail:
+	free_dma_memory( buf );
+	return crop;
+}
+
+
+const struct cropmark *
+cropmark_load(
+	const char *		filename
+)
+{
+	struct cropmark_entry * entry;
+	for( entry = cropmark_list ; entry ; entry = entry->next )
+		if( streq( entry->name, filename ) )
+			return entry->crop;
+
+	unsigned bmp_size;
+	if( FIO_GetFileSize( filename, &bmp_size ) != 0 )
+		return NULL;
+
+	char cache_name[ 64 ];
+	cropmark_cache_name( cache_name, sizeof(cache_name), filename );
+
+	const uint32_t bmp_sum = cropmark_file_sum( filename, bmp_size );
+	struct cropmark * crop = NULL;
+
+	if( bmp_sum )
+		crop = cropmark_read_cache( cache_name, bmp_size, bmp_sum );
+
+	if( !crop )
+	{
+		crop = cropmark_decode( filename, bmp_size, bmp_sum );
+		if( crop && bmp_sum )
+			cropmark_write_cache( cache_name, crop );
+	}
+
+	if( !crop )
+		return NULL;
+
+	entry = malloc( sizeof(*entry) );
+	if( !entry )
+	{
+		free( crop );
+		return NULL;
+	}
+
+	entry->crop = crop;
+	snprintf( entry->name, sizeof(entry->name), "%s", filename );
+	entry->next = cropmark_list;
+	cropmark_list = entry;
+
+	return crop;
+}
+
+
+void
+cropmark_span_row(
+	const struct cropmark *	crop,
+	uint8_t *		row,
+	unsigned		x0,
+	unsigned		x1,
+	unsigned		y
+)
+{
+	unsigned i;
+
+	if( y >= CROPMARK_ROWS )
+		return;
+
+	const unsigned end = crop->rows[y+1];
+	for( i = crop->rows[y] ; i < end ; i++ )
+	{
+		const struct cropmark_span * const span = &crop->spans[i];
+		if( span->x1 <= x0 )
+			continue;
+		if( span->x0 >= x1 )
+			break;
+
+		const unsigned a = span->x0 > x0 ? span->x0 : x0;
+		const unsigned b = span->x1 < x1 ? span->x1 : x1;
+		const uint8_t lo = span->color & 0xFF;
+		const uint8_t hi = span->color >> 8;
+
+		// Runs are never wider than the decoder's row
+		if( lo == hi )
+			span_fill( row + a, b - a, lo );
+		else
+			span_pattern( row + a, cropmark_pair_bits, b - a, lo, hi );
+	}
+}
@@ -0,0 +1,100 @@
+#ifndef _cropmark_h_
+#define _cropmark_h_
+
+/** \file
+ * Pre-decoded cropmark overlays.
+ *
+ * The 8-bit cropmark BMP is decoded once into a list of runs of
+ * identical pixel pairs, sorted by screen row.  A typical set of
+ * frame lines is a few hundred runs, so it takes a few KB instead
+ * of the 346 KB of the raw bitmap and switching between several
+ * loaded files is just a pointer swap.
+ *
+ * The decoded runs are cached on the card next to the BMP, as the
+ * same name with a .crs extension, keyed by the size of the BMP and
+ * a checksum of its first few KB so that an edited file is decoded
+ * again.  An edit that keeps the size and only touches the image
+ * further in is not noticed; delete the .crs file after such edits.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+
+#define CROPMARK_MAGIC		0x32535243	//!< "CRS2"
+#define CROPMARK_ROWS		480
+
+/** One run of identical pixel pairs on a screen row.
+ * x0 and x1 are even; x1 is one past the end of the run.
+ */
+struct cropmark_span
+{
+	uint16_t		y;
+	uint16_t		x0;
+	uint16_t		x1;
+	uint16_t		color;		//!< Both BMP bytes of the pair
+};
+
+SIZE_CHECK_STRUCT( cropmark_span, 8 );
+
+
+/** Decoded cropmarks.  Everything up to the end of spans[] is also
+ * the format of the cache file on the card.
+ */
+struct cropmark
+{
+	uint32_t		magic;
+	uint32_t		bmp_size;	//!< Size of the source BMP
+	uint32_t		bmp_sum;	//!< Checksum of the start of the BMP
+	uint32_t		count;		//!< Number of spans
+
+	/** Index of the first span of each row; row y has the spans
+	 * from rows[y] up to rows[y+1].
+	 */
+	uint16_t		rows[ CROPMARK_ROWS + 2 ];
+
+	struct cropmark_span	spans[ 0 ];
+};
+
+
+/** Load a cropmark BMP, from the cache on the card if it is still
+ * valid.  Each file is decoded once; loading the same name again
+ * returns the copy that is already in memory.  Returns NULL if the
+ * file can not be read or is not an uncompressed 8-bit BMP.
+ */
+extern const struct cropmark *
+cropmark_load(
+	const char *		filename
+);
+
+
+/** Draw the runs of screen row y that fall between x0 and x1 into
+ * row, for an overlay span layer.  x0 and x1 are even.
+ */
+extern void
+cropmark_span_row(
+	const struct cropmark *	crop,
+	uint8_t *		row,
+	unsigned		x0,
+	unsigned		x1,
+	unsigned		y
+);
+
+#endif
@@ -8,6 +8,8 @@
 #include "menu.h"
 #include "property.h"
 #include "config.h"
+#include "span.h"
+#include "decimate.h"
 //#include "lua.h"
 
 #if 0
@@ -132,7 +134,7 @@ print_vbr(
 	int			selected
 )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -240,7 +242,7 @@ efic_temp_display(
 	int			selected
 )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -321,6 +323,173 @@ draw_prop_select( void * priv )
 }
 
 
+static void
+glyph_stats_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		"Glyphs hit %d miss %d evict %d",
+		glyph_stats.hits,
+		glyph_stats.misses,
+		glyph_stats.evictions
+	);
+}
+
+
+static void
+text_cell_stats_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		"Text %d same %d glyph %d kept %d",
+		text_cell_stats.prints,
+		text_cell_stats.skipped,
+		text_cell_stats.drawn,
+		text_cell_stats.kept
+	);
+}
+
+
+/** CONFIG_INT() would define the variables here as statics, but
+ * they belong to span.c so that it builds without config.h.
+ */
+struct config_var
+__attribute__((section(".config_vars")))
+__config_span_burst =
+{
+	.name		= "span.burst",
+	.type		= 0,
+	.value		= &span_burst,
+};
+
+struct config_var
+__attribute__((section(".config_vars")))
+__config_span_gap =
+{
+	.name		= "span.gap",
+	.type		= 0,
+	.value		= &span_gap,
+};
+
+
+/** Time a full screen fill with the primitives against the old loop
+ * of one store and four nops per word.
+ */
+static void
+span_bench( void * priv )
+{
+	uint8_t * const vram = bmp_vram();
+	const unsigned pitch = bmp_pitch();
+	const unsigned width = bmp_width();
+	const unsigned height = bmp_height();
+	const unsigned frames = 4;
+	uint32_t old = 0, fill = 0, pattern = 0;
+	unsigned i, x, y;
+
+	// Alternate pixels, the worst case for the pattern
+	uint8_t bits[ BMP_MAX_WIDTH / 8 ];
+	for( x=0 ; x<sizeof(bits) ; x++ )
+		bits[x] = 0xAA;
+
+	if( !vram )
+		return;
+
+	for( i=0 ; i<frames ; i++ )
+	{
+		uint32_t start = digic_timer();
+		for( y=0 ; y<height ; y++ )
+		{
+			uint32_t * const row = (uint32_t*)( vram + y * pitch );
+			for( x=0 ; x<width/4 ; x++ )
+			{
+				row[x] = 0;
+				asm( "nop" );
+				asm( "nop" );
+				asm( "nop" );
+				asm( "nop" );
+			}
+		}
+		old += digic_timer_elapsed( start );
+
+		start = digic_timer();
+		for( y=0 ; y<height ; y++ )
+			span_fill( vram + y * pitch, width, 0 );
+		fill += digic_timer_elapsed( start );
+
+		start = digic_timer();
+		for( y=0 ; y<height ; y++ )
+			span_pattern( vram + y * pitch, bits, width, COLOR_BG, 0 );
+		pattern += digic_timer_elapsed( start );
+
+		msleep( 10 );
+	}
+
+	bmp_fill( 0, 0, 0, width, height );
+	bmp_printf( FONT_MED, 0, 200,
+		"fill: old %5d us span %5d us pattern %5d us",
+		old / frames,
+		fill / frames,
+		pattern / frames
+	);
+}
+
+
+/** Time each reduction on the live image, with and without chroma.
+ * decimate-bench.c checks the output against a plain box filter.
+ */
+static void
+decimate_bench( void * priv )
+{
+	struct vram_info * vram = &vram_info[ vram_get_number(2) ];
+	const unsigned frames = 8;
+	struct yuv_plane plane;
+	unsigned shift, i;
+
+	if( !vram->vram )
+		return;
+
+	const unsigned size = decimate_size( vram->width, vram->height, DECIMATE_MIN_SHIFT );
+	uint8_t * const buf = malloc( 3 * size );
+	if( !buf )
+		return;
+
+	for( shift=DECIMATE_MIN_SHIFT ; shift<=DECIMATE_MAX_SHIFT ; shift++ )
+	{
+		uint32_t luma_only = 0, yuv = 0;
+
+		for( i=0 ; i<frames ; i++ )
+		{
+			uint32_t start = digic_timer();
+			plane.shift	= shift;
+			plane.luma	= buf;
+			plane.u		= NULL;
+			plane.v		= NULL;
+			decimate( vram->vram, vram->width, vram->height, vram->pitch, &plane );
+			luma_only += digic_timer_elapsed( start );
+
+			start = digic_timer();
+			plane.u		= buf + size;
+			plane.v		= buf + 2 * size;
+			decimate( vram->vram, vram->width, vram->height, vram->pitch, &plane );
+			yuv += digic_timer_elapsed( start );
+
+			msleep( 10 );
+		}
+
+		bmp_printf( FONT_MED, 0, 200 + 20 * shift,
+			"decimate %dx: Y %5d us YUV %5d us",
+			1 << shift,
+			luma_only / frames,
+			yuv / frames
+		);
+	}
+
+	free( buf );
+}
+
+
 static void
 save_config( void * priv )
 {
@@ -366,6 +535,22 @@ struct menu_entry debug_menus[] = {
 		.select		= call_dispcheck,
 		.display	= menu_print,
 	},
+	{
+		.display	= glyph_stats_display,
+	},
+	{
+		.display	= text_cell_stats_display,
+	},
+	{
+		.priv		= "Span bench",
+		.select		= span_bench,
+		.display	= menu_print,
+	},
+	{
+		.priv		= "Decimate bench",
+		.select		= decimate_bench,
+		.display	= menu_print,
+	},
 
 #if 0
 	{
@@ -0,0 +1,257 @@
+/** \file
+ * Host check and timing of decimate().
+ *
+ * Synthetic UYVY frames are reduced at every supported factor and
+ * compared byte for byte against a plain box filter that reads one
+ * pixel at a time and averages chroma as signed values.  The frames
+ * include chroma that straddles zero inside a box, which is where
+ * an unsigned average goes wrong.
+ *
+ *	make decimate-bench && ./decimate-bench
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "decimate.h"
+
+
+/** Frame sizes seen on the 5D2: LCD, recording and HDMI */
+static const struct
+{
+	unsigned		width;
+	unsigned		height;
+	unsigned		pitch;
+} frames[] = {
+	{  720,  480,  720 },
+	{ 1024,  680, 1024 },
+	{ 1920, 1080, 1920 },
+	{  720,  480,  736 },	// padded rows
+	{  722,  483,  724 },	// partial boxes at the edges
+};
+
+
+static double
+now( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/** Random image, except for a band where U and V are small and of
+ * both signs so that most boxes there average across zero.
+ */
+static void
+make_frame(
+	uint16_t *		vram,
+	unsigned		width,
+	unsigned		height,
+	unsigned		pitch
+)
+{
+	unsigned x, y;
+
+	for( y=0 ; y<height ; y++ )
+	{
+		uint8_t * const row = (uint8_t*)( vram + y * pitch );
+		const int band = (y / 16) & 1;
+
+		for( x=0 ; x<width * 2 ; x += 4 )
+		{
+			row[x+0] = band ? (rand() % 9) - 4 : rand();	// U
+			row[x+1] = rand();				// Y0
+			row[x+2] = band ? (rand() % 9) - 4 : rand();	// V
+			row[x+3] = rand();				// Y1
+		}
+	}
+}
+
+
+/** Floor of a / b for any sign of a */
+static int
+floor_div(
+	int			a,
+	int			b
+)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+
+/** The box filter one pixel at a time, with signed chroma */
+static void
+reference(
+	const uint16_t *	vram,
+	unsigned		vram_width,
+	unsigned		vram_height,
+	unsigned		pitch,
+	unsigned		shift,
+	uint8_t *		luma,
+	uint8_t *		u,
+	uint8_t *		v
+)
+{
+	const unsigned f = 1 << shift;
+	const unsigned width = vram_width >> shift;
+	const unsigned height = vram_height >> shift;
+	unsigned x, y, dx, dy;
+
+	for( y=0 ; y<height ; y++ )
+	{
+		for( x=0 ; x<width ; x++ )
+		{
+			unsigned l = 0;
+			int su = 0, sv = 0;
+
+			for( dy=0 ; dy<f ; dy++ )
+			{
+				const uint8_t * const row = (const uint8_t*)(
+					vram + (y * f + dy) * pitch
+				);
+
+				for( dx=0 ; dx<f ; dx++ )
+				{
+					const unsigned px = x * f + dx;
+					const uint8_t * const w = row + (px & ~1) * 2;
+					l += w[ (px & 1) ? 3 : 1 ];
+
+					// Each word carries one U and one V
+					if( px & 1 )
+						continue;
+					su += (int8_t) w[0];
+					sv += (int8_t) w[2];
+				}
+			}
+
+			*luma++ = l / (f * f);
+			*u++ = floor_div( su, f * f / 2 );
+			*v++ = floor_div( sv, f * f / 2 );
+		}
+	}
+}
+
+
+int
+main( void )
+{
+	unsigned i, shift;
+	int errors = 0;
+
+	srand( 1 );
+
+	for( i=0 ; i<sizeof(frames)/sizeof(frames[0]) ; i++ )
+	{
+		const unsigned width = frames[i].width;
+		const unsigned height = frames[i].height;
+		const unsigned pitch = frames[i].pitch;
+
+		uint16_t * vram;
+		if( posix_memalign( (void**) &vram, 8, pitch * height * 2 ) )
+			return 1;
+		make_frame( vram, width, height, pitch );
+
+		for( shift=DECIMATE_MIN_SHIFT ; shift<=DECIMATE_MAX_SHIFT ; shift++ )
+		{
+			const unsigned size = decimate_size( width, height, shift );
+			uint8_t * const want = malloc( 3 * size );
+			uint8_t * const got = malloc( 3 * size );
+			const unsigned reps = 20;
+			unsigned r;
+
+			struct yuv_plane plane = {
+				.shift	= shift,
+				.luma	= got,
+				.u	= got + size,
+				.v	= got + 2 * size,
+			};
+
+			if( (width >> shift) > DECIMATE_MAX_WIDTH )
+			{
+				if( decimate( vram, width, height, pitch, &plane ) )
+				{
+					printf( "%4dx%-4d %dx: accepted a frame too wide\n",
+						width, height, 1 << shift );
+					errors++;
+				}
+				free( want );
+				free( got );
+				continue;
+			}
+
+			const double t0 = now();
+			for( r=0 ; r<reps ; r++ )
+				reference( vram, width, height, pitch, shift,
+					want, want + size, want + 2 * size );
+			const double t1 = now();
+			for( r=0 ; r<reps ; r++ )
+				decimate( vram, width, height, pitch, &plane );
+			const double t2 = now();
+
+			// Luma only must give the same luma
+			memset( got + size, 0, 2 * size );
+			plane.u = plane.v = NULL;
+			decimate( vram, width, height, pitch, &plane );
+			const double t3 = now();
+
+			unsigned bad = 0;
+			for( r=0 ; r<3 * size ; r++ )
+			{
+				const uint8_t expect = r < size ? want[r] : 0;
+				bad += got[r] != expect;
+			}
+
+			// And with chroma, every plane
+			plane.u = got + size;
+			plane.v = got + 2 * size;
+			decimate( vram, width, height, pitch, &plane );
+			bad += memcmp( got, want, 3 * size ) != 0;
+
+			if( plane.width != width >> shift
+			||  plane.height != height >> shift )
+				bad++;
+
+			printf( "%4dx%-4d %dx: ref %7.1f us yuv %7.1f us y %7.1f us %s\n",
+				width,
+				height,
+				1 << shift,
+				(t1 - t0) / reps * 1e6,
+				(t2 - t1) / reps * 1e6,
+				(t3 - t2) * 1e6,
+				bad ? "MISMATCH" : "ok"
+			);
+
+			errors += bad != 0;
+			free( want );
+			free( got );
+		}
+
+		free( vram );
+	}
+
+	printf( "%d errors\n", errors );
+	return errors != 0;
+}
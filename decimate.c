@@ -0,0 +1,123 @@
+/** \file
+ * Box filter downscaling of the LiveView buffer.
+ *
+ * The output is built one box at a time: the words of each source
+ * row of the box are read once and summed, and the box is stored.
+ * The two lumas of a word go into the two 16-bit lanes of one
+ * accumulator and U and V into the lanes of another, so every word
+ * is two masks and two adds.  At 8x a lane sums at most 32 values,
+ * which still fits in 16 bits.  There is no state between boxes,
+ * so any task can call decimate() without a lock.
+ *
+ * U and V are signed.  Flipping their top bits makes them offset
+ * binary, which sums and averages as unsigned; the average is
+ * flipped back when it is stored.
+ *
+ * This file only needs swar.h, so it also builds and runs on the
+ * host; see decimate-bench.c.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "swar.h"
+#include "decimate.h"
+
+/** Sign bits of U and V in a UYVY word */
+#define DECIMATE_CHROMA_SIGN	0x00800080
+
+
+int
+decimate(
+	const uint16_t *	vram,
+	unsigned		vram_width,
+	unsigned		vram_height,
+	unsigned		vram_pitch,
+	struct yuv_plane *	plane
+)
+{
+	const unsigned shift = plane->shift;
+	if( shift < DECIMATE_MIN_SHIFT || shift > DECIMATE_MAX_SHIFT )
+		return 0;
+
+	const unsigned width = vram_width >> shift;
+	const unsigned height = vram_height >> shift;
+	if( !vram || width == 0 || width > DECIMATE_MAX_WIDTH )
+		return 0;
+
+	const int chroma = plane->u && plane->v;
+	const unsigned luma_shift = 2 * shift;		// f * f pixels
+	const unsigned chroma_shift = 2 * shift - 1;	// f/2 * f words
+	const unsigned rows = 1 << shift;
+	const unsigned words = 1 << (shift - 1);	// per box row
+	const unsigned pitch = vram_pitch / 2;		// in words
+	unsigned x, y, dy, i;
+
+	uint8_t * luma = plane->luma;
+	uint8_t * u = plane->u;
+	uint8_t * v = plane->v;
+
+	for( y=0 ; y<height ; y++ )
+	{
+		const uint32_t * box = (const uint32_t*)(
+			vram + (y << shift) * vram_pitch
+		);
+
+		for( x=0 ; x<width ; x++, box += words )
+		{
+			const uint32_t * src = box;
+			uint32_t l = 0;
+			uint32_t c = 0;
+
+			for( dy=0 ; dy<rows ; dy++, src += pitch )
+			{
+				if( words == 1 )
+				{
+					const uint32_t w = src[0];
+					l += (w >> 8) & SWAR_LANE_MASK;
+					c += (w ^ DECIMATE_CHROMA_SIGN) & SWAR_LANE_MASK;
+					continue;
+				}
+
+				// Pairs of words with one LDRD
+				for( i=0 ; i<words ; i += 2 )
+				{
+					uint32_t w0, w1;
+					swar_load4( &src[i], &w0, &w1 );
+					l += ((w0 >> 8) & SWAR_LANE_MASK)
+					   + ((w1 >> 8) & SWAR_LANE_MASK);
+					c += ((w0 ^ DECIMATE_CHROMA_SIGN) & SWAR_LANE_MASK)
+					   + ((w1 ^ DECIMATE_CHROMA_SIGN) & SWAR_LANE_MASK);
+				}
+			}
+
+			*luma++ = ((l & 0xFFFF) + (l >> 16)) >> luma_shift;
+
+			if( !chroma )
+				continue;
+
+			*u++ = ((c & 0xFFFF) >> chroma_shift) ^ 0x80;
+			*v++ = ((c >> 16) >> chroma_shift) ^ 0x80;
+		}
+	}
+
+	plane->width = width;
+	plane->height = height;
+	return 1;
+}
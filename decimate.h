@@ -0,0 +1,81 @@
+#ifndef _decimate_h_
+#define _decimate_h_
+
+/** \file
+ * Box filter downscaling of the LiveView buffer.
+ *
+ * A UYVY buffer is reduced by 2, 4 or 8 in each direction into
+ * planes of 8-bit luma and, if wanted, 8-bit U and V at the same
+ * reduced size, into buffers owned by the caller.
+ *
+ * The frame is passed as its fields rather than as a vram_info so
+ * that the filter does not need the camera headers.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+
+#define DECIMATE_MIN_SHIFT	1	//!< 2x
+#define DECIMATE_MAX_SHIFT	3	//!< 8x
+#define DECIMATE_MAX_WIDTH	(1024 >> DECIMATE_MIN_SHIFT)
+
+
+/** A reduced view of one LiveView frame.  Each plane is width
+ * bytes per row with no padding.
+ */
+struct yuv_plane
+{
+	unsigned		shift;		//!< log2 of the reduction
+	unsigned		width;
+	unsigned		height;
+	uint8_t *		luma;
+	uint8_t *		u;		//!< Signed, as in the VRAM; NULL to skip chroma
+	uint8_t *		v;
+};
+
+
+/** Bytes needed for one plane of a buffer reduced by 1 << shift */
+static inline unsigned
+decimate_size(
+	unsigned		vram_width,
+	unsigned		vram_height,
+	unsigned		shift
+)
+{
+	return (vram_width >> shift) * (vram_height >> shift);
+}
+
+
+/** Downscale a UYVY frame into the caller's buffers.  The width and
+ * the pitch are in pixels, as in vram_info.  plane->shift and the
+ * plane pointers must be set; width and height are filled in.
+ * Returns 0 if the shift or the frame size is not supported.
+ */
+extern int
+decimate(
+	const uint16_t *	vram,
+	unsigned		vram_width,
+	unsigned		vram_height,
+	unsigned		vram_pitch,
+	struct yuv_plane *	plane
+);
+
+#endif
@@ -74,6 +74,29 @@ msleep(
 );
 
 
+/** Free running microsecond counter in the DIGIC.
+ * It is only 20 bits wide and wraps every 1.048576 seconds,
+ * so it is only good for timing short intervals.
+ */
+#define DIGIC_TIMER_US		((volatile uint32_t *) 0xC0242014)
+#define DIGIC_TIMER_MASK	0xFFFFF
+
+static inline uint32_t
+digic_timer( void )
+{
+	return *DIGIC_TIMER_US & DIGIC_TIMER_MASK;
+}
+
+/** Microseconds since start, which came from digic_timer() */
+static inline uint32_t
+digic_timer_elapsed(
+	uint32_t		start
+)
+{
+	return (digic_timer() - start) & DIGIC_TIMER_MASK;
+}
+
+
 
 /** Create a new user level task.
  *
@@ -0,0 +1,392 @@
+/** \file
+ * Per-frame exposure statistics.
+ *
+ * The scan fills exposure_accum[]; at the end of the frame it is
+ * summarised into the one of two frame buffers that readers are not
+ * looking at, which is then published by bumping a generation count.
+ * Readers copy out of the published buffer and copy again if the
+ * count moved underneath them, so a query from the menu task never
+ * sees half of one frame and half of the next.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "config.h"
+#include "exposure.h"
+
+CONFIG_INT( "exposure.pct-lo",	exposure_pct_lo,	5 );
+CONFIG_INT( "exposure.pct-hi",	exposure_pct_hi,	95 );
+CONFIG_INT( "exposure.clip-lo",	exposure_clip_lo,	4 );
+CONFIG_INT( "exposure.clip-hi",	exposure_clip_hi,	251 );
+
+uint32_t exposure_accum[ EXPOSURE_BINS ];
+uint16_t exposure_tile_accum[ EXPOSURE_TILES_Y ][ EXPOSURE_TILES_X ][ EXPOSURE_TILE_BINS ];
+uint32_t exposure_tile_scale_x;
+uint32_t exposure_tile_scale_y;
+uint32_t exposure_roi_x;
+uint32_t exposure_roi_y;
+uint32_t exposure_roi_w;
+uint32_t exposure_roi_h;
+uint32_t exposure_roi_accum[ EXPOSURE_TILE_BINS ];
+
+/** One complete frame */
+struct exposure_frame
+{
+	struct exposure_stats	stats;
+	uint32_t		bins[ EXPOSURE_BINS ];
+	uint16_t		tiles[ EXPOSURE_TILES_Y ][ EXPOSURE_TILES_X ][ EXPOSURE_TILE_BINS ];
+	unsigned		width;
+	unsigned		height;
+
+	/** The region gathered exactly, if roi_w is not 0 */
+	uint32_t		roi[ EXPOSURE_TILE_BINS ];
+	unsigned		roi_x;
+	unsigned		roi_y;
+	unsigned		roi_w;
+	unsigned		roi_h;
+};
+
+static struct exposure_frame	frames[2];
+
+/** frames[ exposure_published & 1 ] is the last complete frame */
+static volatile uint32_t	exposure_published;
+
+static unsigned			frame_width;	//!< Frame size being gathered
+static unsigned			frame_height;
+
+/** Region for the next frame */
+static unsigned			roi_x;
+static unsigned			roi_y;
+static unsigned			roi_w;
+static unsigned			roi_h;
+
+/** Keep the compiler from moving frame accesses across the count */
+#define exposure_barrier()	asm volatile( "" : : : "memory" )
+
+
+static const struct exposure_frame *
+exposure_read_begin(
+	uint32_t *		gen
+)
+{
+	*gen = exposure_published;
+	exposure_barrier();
+	return &frames[ *gen & 1 ];
+}
+
+
+/** Nonzero if exposure_end() has published a frame since the read
+ * began, in which case the next one may have been written over it.
+ */
+static int
+exposure_read_retry(
+	uint32_t		gen
+)
+{
+	exposure_barrier();
+	return gen != exposure_published;
+}
+
+
+void
+exposure_set_region(
+	unsigned		x,
+	unsigned		y,
+	unsigned		w,
+	unsigned		h
+)
+{
+	roi_x	= x;
+	roi_y	= y;
+	roi_w	= h ? w : 0;
+	roi_h	= w ? h : 0;
+}
+
+
+void
+exposure_begin(
+	unsigned		width,
+	unsigned		height
+)
+{
+	unsigned i;
+	for( i=0 ; i<EXPOSURE_BINS ; i++ )
+		exposure_accum[i] = 0;
+
+	uint32_t * const tiles = (uint32_t*) exposure_tile_accum;
+	for( i=0 ; i<sizeof(exposure_tile_accum)/4 ; i++ )
+		tiles[i] = 0;
+
+	for( i=0 ; i<EXPOSURE_TILE_BINS ; i++ )
+		exposure_roi_accum[i] = 0;
+	exposure_roi_x		= roi_x;
+	exposure_roi_y		= roi_y;
+	exposure_roi_w		= roi_w;
+	exposure_roi_h		= roi_h;
+
+	// Round the scale down so that x = width - 1 is still in range
+	frame_width		= width;
+	frame_height		= height;
+	exposure_tile_scale_x	= width ? ((EXPOSURE_TILES_X << 16) - 1) / width : 0;
+	exposure_tile_scale_y	= height ? ((EXPOSURE_TILES_Y << 16) - 1) / height : 0;
+}
+
+
+/** Find the bin where the running count reaches target */
+static unsigned
+exposure_find(
+	const uint32_t *	bins,
+	uint32_t		target
+)
+{
+	uint32_t sum = 0;
+	unsigned i;
+
+	for( i=0 ; i<EXPOSURE_BINS-1 ; i++ )
+	{
+		sum += bins[i];
+		if( sum >= target )
+			break;
+	}
+
+	return i;
+}
+
+
+static inline uint32_t
+exposure_target(
+	uint32_t		count,
+	unsigned		pct
+)
+{
+	if( pct > 100 )
+		pct = 100;
+	return count * pct / 100;
+}
+
+
+void
+exposure_end( void )
+{
+	uint32_t count = 0;
+	uint32_t sum = 0;
+	uint32_t lo = 0;
+	uint32_t hi = 0;
+	uint32_t hist_max = 0;
+	unsigned i;
+
+	// Only this task writes, and never to the published frame
+	struct exposure_frame * const f = &frames[ (exposure_published + 1) & 1 ];
+	struct exposure_stats * const stats = &f->stats;
+
+	for( i=0 ; i<EXPOSURE_BINS ; i++ )
+	{
+		const uint32_t n = exposure_accum[i];
+		f->bins[i] = n;
+
+		count	+= n;
+		sum	+= n * i;
+
+		if( i <= exposure_clip_lo )
+			lo += n;
+		if( i >= exposure_clip_hi )
+			hi += n;
+
+		// The 128 bin histogram box ignores its 0 bin; it is
+		// too noisy to scale by.
+		if( (i & 1) && i > 1 )
+		{
+			const uint32_t pair = n + exposure_accum[i-1];
+			if( pair > hist_max )
+				hist_max = pair;
+		}
+	}
+
+	stats->frame	= exposure_published + 1;
+	stats->count	= count;
+	stats->hist_max	= hist_max;
+
+	memcpy( f->tiles, exposure_tile_accum, sizeof(f->tiles) );
+	f->width	= frame_width;
+	f->height	= frame_height;
+
+	memcpy( f->roi, exposure_roi_accum, sizeof(f->roi) );
+	f->roi_x	= exposure_roi_x;
+	f->roi_y	= exposure_roi_y;
+	f->roi_w	= exposure_roi_w;
+	f->roi_h	= exposure_roi_h;
+
+	if( count )
+	{
+		stats->mean	= sum / count;
+		stats->median	= exposure_find( f->bins, exposure_target( count, 50 ) );
+		stats->pct_lo	= exposure_find( f->bins, exposure_target( count, exposure_pct_lo ) );
+		stats->pct_hi	= exposure_find( f->bins, exposure_target( count, exposure_pct_hi ) );
+		stats->clip_lo	= lo * 1000 / count;
+		stats->clip_hi	= hi * 1000 / count;
+	} else {
+		stats->mean	= 0;
+		stats->median	= 0;
+		stats->pct_lo	= 0;
+		stats->pct_hi	= 0;
+		stats->clip_lo	= 0;
+		stats->clip_hi	= 0;
+	}
+
+	exposure_barrier();
+	exposure_published++;
+}
+
+
+void
+exposure_get(
+	struct exposure_stats *	stats
+)
+{
+	const struct exposure_frame * f;
+	uint32_t gen;
+
+	do {
+		f = exposure_read_begin( &gen );
+		*stats = f->stats;
+	} while( exposure_read_retry( gen ) );
+}
+
+
+unsigned
+exposure_percentile(
+	unsigned		pct
+)
+{
+	const struct exposure_frame * f;
+	uint32_t gen;
+	unsigned luma;
+
+	do {
+		f = exposure_read_begin( &gen );
+		luma = exposure_find(
+			f->bins,
+			exposure_target( f->stats.count, pct )
+		);
+	} while( exposure_read_retry( gen ) );
+
+	return luma;
+}
+
+
+void
+exposure_histogram(
+	uint32_t *		bins,
+	struct exposure_stats *	stats
+)
+{
+	const struct exposure_frame * f;
+	uint32_t gen;
+
+	do {
+		f = exposure_read_begin( &gen );
+		memcpy( bins, f->bins, sizeof(f->bins) );
+		if( stats )
+			*stats = f->stats;
+	} while( exposure_read_retry( gen ) );
+}
+
+
+static uint32_t
+exposure_region_sum(
+	const struct exposure_frame *	f,
+	unsigned		x,
+	unsigned		y,
+	unsigned		w,
+	unsigned		h,
+	uint32_t *		bins
+)
+{
+	unsigned i, tx, ty;
+	uint32_t count = 0;
+
+	for( i=0 ; i<EXPOSURE_TILE_BINS ; i++ )
+		bins[i] = 0;
+
+	if( !f->width || !f->height )
+		return 0;
+
+	// The region that was gathered exactly
+	if( f->roi_w
+	&&  x == f->roi_x && y == f->roi_y
+	&&  w == f->roi_w && h == f->roi_h )
+	{
+		for( i=0 ; i<EXPOSURE_TILE_BINS ; i++ )
+		{
+			bins[i] = f->roi[i];
+			count += f->roi[i];
+		}
+		return count;
+	}
+
+	// Tiles that the region touches
+	const unsigned tx0 = (x * EXPOSURE_TILES_X) / f->width;
+	const unsigned ty0 = (y * EXPOSURE_TILES_Y) / f->height;
+	unsigned tx1 = ((x + w) * EXPOSURE_TILES_X + f->width - 1) / f->width;
+	unsigned ty1 = ((y + h) * EXPOSURE_TILES_Y + f->height - 1) / f->height;
+
+	if( tx1 > EXPOSURE_TILES_X )
+		tx1 = EXPOSURE_TILES_X;
+	if( ty1 > EXPOSURE_TILES_Y )
+		ty1 = EXPOSURE_TILES_Y;
+
+	for( ty=ty0 ; ty<ty1 ; ty++ )
+	{
+		for( tx=tx0 ; tx<tx1 ; tx++ )
+		{
+			const uint16_t * const tile = f->tiles[ty][tx];
+			for( i=0 ; i<EXPOSURE_TILE_BINS ; i++ )
+			{
+				bins[i] += tile[i];
+				count += tile[i];
+			}
+		}
+	}
+
+	return count;
+}
+
+
+uint32_t
+exposure_region(
+	unsigned		x,
+	unsigned		y,
+	unsigned		w,
+	unsigned		h,
+	uint32_t *		bins
+)
+{
+	const struct exposure_frame * f;
+	uint32_t gen;
+	uint32_t count;
+
+	do {
+		f = exposure_read_begin( &gen );
+		count = exposure_region_sum( f, x, y, w, h, bins );
+	} while( exposure_read_retry( gen ) );
+
+	return count;
+}
@@ -0,0 +1,173 @@
+#ifndef _exposure_h_
+#define _exposure_h_
+
+/** \file
+ * Per-frame exposure statistics.
+ *
+ * A 256 bin luma histogram is filled by the overlay scan that
+ * already feeds the histogram and waveform, and summarised once
+ * the frame is finished.  Any module can read the numbers for the
+ * last complete frame without scanning the LiveView buffer itself.
+ *
+ * The same pass also fills a coarse histogram for each tile of an
+ * 8 x 8 grid over the frame.  The histogram of a region is the sum
+ * of the tiles that it covers, so region queries never rescan.  One
+ * region can also be set up before the frame; it is then gathered
+ * exactly by the same pass, for the histogram ROI.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "swar.h"
+
+#define EXPOSURE_BINS		256
+
+#define EXPOSURE_TILES_X	8
+#define EXPOSURE_TILES_Y	8
+#define EXPOSURE_TILE_SHIFT	3	//!< Luma to tile bin
+#define EXPOSURE_TILE_BINS	(EXPOSURE_BINS >> EXPOSURE_TILE_SHIFT)
+
+
+/** Summary of the last complete frame.  Luma values are 0 to 255. */
+struct exposure_stats
+{
+	uint32_t		frame;		//!< Incremented for every frame
+	uint32_t		count;		//!< Pixels in the frame
+	uint32_t		mean;
+	uint32_t		median;
+	uint32_t		pct_lo;		//!< Luma at exposure.pct-lo
+	uint32_t		pct_hi;		//!< Luma at exposure.pct-hi
+	uint32_t		clip_lo;	//!< Per mille at or below exposure.clip-lo
+	uint32_t		clip_hi;	//!< Per mille at or above exposure.clip-hi
+	uint32_t		hist_max;	//!< Largest of 128 bins, ignoring bin 0
+};
+
+
+/** Bins being filled by the scan in progress */
+extern uint32_t exposure_accum[ EXPOSURE_BINS ];
+extern uint16_t exposure_tile_accum[ EXPOSURE_TILES_Y ][ EXPOSURE_TILES_X ][ EXPOSURE_TILE_BINS ];
+
+/** 16.16 scale from LiveView pixels to tiles */
+extern uint32_t exposure_tile_scale_x;
+extern uint32_t exposure_tile_scale_y;
+
+/** The exact region of the scan in progress and its bins */
+extern uint32_t exposure_roi_x;
+extern uint32_t exposure_roi_y;
+extern uint32_t exposure_roi_w;
+extern uint32_t exposure_roi_h;
+extern uint32_t exposure_roi_accum[ EXPOSURE_TILE_BINS ];
+
+
+/** Gather the region exactly, in LiveView pixels, from the next
+ * exposure_begin() on.  w or h of 0 turns it off.  Called by the
+ * task that runs the scan.
+ */
+extern void
+exposure_set_region(
+	unsigned		x,
+	unsigned		y,
+	unsigned		w,
+	unsigned		h
+);
+
+
+/** Clear the bins for a new frame of the given size */
+extern void
+exposure_begin(
+	unsigned		width,
+	unsigned		height
+);
+
+
+/** Add both pixels of the LiveView UYVY word at x,y */
+static inline void
+exposure_add(
+	unsigned		x,
+	unsigned		y,
+	uint32_t		pixel
+)
+{
+	const uint32_t luma = swar_luma( pixel );
+	exposure_accum[ luma & 0xFF ]++;
+	exposure_accum[ luma >> 16 ]++;
+
+	// One sample of the pair average is enough for the tiles
+	const unsigned bin = swar_luma_avg( pixel ) >> EXPOSURE_TILE_SHIFT;
+	const unsigned tx = (x * exposure_tile_scale_x) >> 16;
+	const unsigned ty = (y * exposure_tile_scale_y) >> 16;
+	exposure_tile_accum[ty][tx][bin]++;
+
+	// Unsigned, so that left of or above the region is out too
+	if( x - exposure_roi_x < exposure_roi_w
+	&&  y - exposure_roi_y < exposure_roi_h )
+		exposure_roi_accum[bin]++;
+}
+
+
+/** The frame is complete; compute the summary */
+extern void
+exposure_end( void );
+
+
+/** Copy the statistics of the last complete frame.  Safe from any
+ * task; a frame finished during the copy makes it start over.
+ */
+extern void
+exposure_get(
+	struct exposure_stats *	stats
+);
+
+
+/** Luma at or below which pct percent of the pixels of the last
+ * complete frame fall.
+ */
+extern unsigned
+exposure_percentile(
+	unsigned		pct
+);
+
+
+/** Copy the 256 bin histogram of the last complete frame, and its
+ * statistics if stats is not NULL, both from the same frame.
+ */
+extern void
+exposure_histogram(
+	uint32_t *		bins,
+	struct exposure_stats *	stats
+);
+
+
+/** Histogram of a region of the last complete frame, in LiveView
+ * pixels, with EXPOSURE_TILE_BINS bins.  It is exact if the region
+ * is the one that was set for that frame; any other region is
+ * rounded out to whole tiles.  Returns the number of samples.
+ */
+extern uint32_t
+exposure_region(
+	unsigned		x,
+	unsigned		y,
+	unsigned		w,
+	unsigned		h,
+	uint32_t *		bins
+);
+
+#endif
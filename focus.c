@@ -139,7 +139,7 @@ focus_dir_display(
 	int			selected
 ) {
 
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -156,7 +156,7 @@ focus_show_a(
 	int			selected
 ) {
 
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -190,7 +190,7 @@ focus_rack_speed_display(
 	int			selected
 )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
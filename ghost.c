@@ -0,0 +1,401 @@
+/** \file
+ * Ghost image overlay.
+ *
+ * A LiveView frame is captured at half resolution as 4-bit luma,
+ * two pixels to a byte; 360x240 is 42 KB.  Larger buffers are
+ * reduced further so that the store stays under 100 KB.
+ *
+ * The overlay layer draws it a row at a time: the stored row is
+ * split into runs of one level, and each run is written with
+ * span_pattern() through an ordered dither, so that ghost.alpha
+ * sixteenths of the pixels show the stored frame and the rest stay
+ * transparent.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "bmp.h"
+#include "menu.h"
+#include "config.h"
+#include "overlay.h"
+#include "span.h"
+#include "decimate.h"
+
+#define GHOST_MAX_STORE		(100 * 1024)	//!< Bytes of packed luma
+#define GHOST_MAX_WIDTH		DECIMATE_MAX_WIDTH
+#define GHOST_BITS		(BMP_MAX_WIDTH / 8 + 1)
+
+CONFIG_INT( "ghost.draw",	ghost_draw,	0 );
+CONFIG_INT( "ghost.alpha",	ghost_alpha,	8 );	// sixteenths shown
+
+/** Packed 4-bit luma, even columns in the low nibble.  The layer
+ * reads these under the overlay lock, so they are only replaced
+ * while holding it.
+ */
+static uint8_t *	ghost_store;
+static unsigned		ghost_shift;		//!< Store to VRAM scale
+static unsigned		ghost_width;
+static unsigned		ghost_height;
+static unsigned		ghost_pitch;		//!< Bytes per stored row
+
+/** Stored level to a BMP grey */
+static uint8_t		ghost_color[ 16 ];
+
+/** Dither pattern of each row of the 4x4 cell for a run starting
+ * at each column of the cell, one bit per BMP pixel.
+ */
+static uint8_t		ghost_bits[4][4][ GHOST_BITS ];
+
+/** First BMP column of each stored column, for the map it was built
+ * with; ghost_col_x[ghost_width] is the BMP width.
+ */
+static uint16_t		ghost_col_x[ GHOST_MAX_WIDTH + 1 ];
+static uint32_t		ghost_col_generation;
+
+/** Runs of equal level in the last stored row drawn, in BMP columns.
+ * Several BMP rows show the same stored row, so it is reused.
+ */
+struct ghost_run
+{
+	uint16_t		x0;
+	uint16_t		x1;
+	uint8_t			color;
+};
+
+static struct ghost_run	ghost_runs[ GHOST_MAX_WIDTH ];
+static unsigned		ghost_run_count;
+static int		ghost_run_row = -1;
+
+static const uint8_t	bayer[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+
+static void
+ghost_tables( void )
+{
+	unsigned x, y, i;
+
+	for( i=0 ; i<16 ; i++ )
+	{
+		// Grey ramp of the BMP palette, 0x26 to 0x50
+		ghost_color[i] = 0x26 + (i * 42) / 15;
+	}
+
+	// The cell is 4 wide, so every byte of a pattern is the same
+	for( y=0 ; y<4 ; y++ )
+	{
+		for( x=0 ; x<4 ; x++ )
+		{
+			uint8_t b = 0;
+			for( i=0 ; i<8 ; i++ )
+				if( bayer[y][ (x + i) & 3 ] < ghost_alpha )
+					b |= 0x80 >> i;
+
+			for( i=0 ; i<GHOST_BITS ; i++ )
+				ghost_bits[y][x][i] = b;
+		}
+	}
+}
+
+
+/** Smallest reduction that fits the decimator and keeps the packed
+ * store under GHOST_MAX_STORE; 0 if none does.  Half size on the
+ * LCD, quarter size for a 1080 line buffer.
+ */
+static unsigned
+ghost_pick_shift(
+	const struct vram_info *	vram
+)
+{
+	unsigned shift;
+
+	for( shift=DECIMATE_MIN_SHIFT ; shift<=DECIMATE_MAX_SHIFT ; shift++ )
+	{
+		const unsigned width = vram->width >> shift;
+		const unsigned height = vram->height >> shift;
+
+		if( width <= GHOST_MAX_WIDTH
+		&&  ((width + 1) / 2) * height <= GHOST_MAX_STORE )
+			return shift;
+	}
+
+	return 0;
+}
+
+
+/** Grab the current LiveView frame into a new store and swap it in */
+static void
+ghost_capture( void * priv )
+{
+	struct vram_info * vram = &vram_info[ vram_get_number(2) ];
+	if( !vram->vram )
+		return;
+
+	const unsigned shift = ghost_pick_shift( vram );
+	if( !shift )
+		return;
+
+	const unsigned size = decimate_size( vram->width, vram->height, shift );
+	uint8_t * const luma = malloc( size );
+	if( !luma )
+		return;
+
+	uint8_t * store = NULL;
+	struct yuv_plane plane = {
+		.shift		= shift,
+		.luma		= luma,
+	};
+
+	if( !decimate( vram->vram, vram->width, vram->height, vram->pitch, &plane ) )
+		goto done;
+
+	const unsigned pitch = (plane.width + 1) / 2;
+	const unsigned store_size = pitch * plane.height;
+
+	store = malloc( store_size );
+	if( !store )
+		goto done;
+
+	unsigned x, y;
+	const uint8_t * src = luma;
+
+	for( y=0 ; y<plane.height ; y++ )
+	{
+		uint8_t * const dst = &store[ y * pitch ];
+		for( x=0 ; x<plane.width ; x += 2, src += 2 )
+		{
+			const unsigned hi = x + 1 < plane.width ? src[1] >> 4 : 0;
+			dst[x/2] = (src[0] >> 4) | (hi << 4);
+		}
+
+		// Odd widths have one byte too many in the row
+		src -= x - plane.width;
+	}
+
+	// The layer may be drawing from the old store right now
+	overlay_lock();
+
+	uint8_t * const old = ghost_store;
+	ghost_store		= store;
+	ghost_shift		= shift;
+	ghost_pitch		= pitch;
+	ghost_height		= plane.height;
+	ghost_width		= plane.width;
+	ghost_col_generation	= 0;
+	ghost_run_row		= -1;
+
+	overlay_unlock();
+
+	store = old;
+
+	DebugMsg( DM_MAGIC, 3, "%s: %dx%d, %d bytes",
+		__func__,
+		plane.width,
+		plane.height,
+		store_size
+	);
+
+done:
+	if( store )
+		free( store );
+	free( luma );
+}
+
+
+/** Find the first BMP column of each stored column */
+static void
+ghost_columns(
+	const struct bmp_map *	map
+)
+{
+	unsigned x, g = 0;
+
+	for( x=0 ; x<map->bmp_width ; x++ )
+	{
+		const unsigned v = map->vram_x[x] >> ghost_shift;
+		while( g <= v && g <= ghost_width )
+			ghost_col_x[ g++ ] = x;
+	}
+
+	while( g <= ghost_width )
+		ghost_col_x[ g++ ] = map->bmp_width;
+
+	ghost_col_generation = map->generation;
+	ghost_run_row = -1;
+}
+
+
+/** Split stored row gy into runs of one level, in BMP columns */
+static void
+ghost_row_runs(
+	unsigned		gy
+)
+{
+	const uint8_t * const row = &ghost_store[ gy * ghost_pitch ];
+	unsigned gx = 0;
+
+	ghost_run_count = 0;
+
+	while( gx < ghost_width )
+	{
+		const unsigned start = gx;
+		const unsigned level = (row[gx/2] >> ((gx & 1) * 4)) & 0xF;
+
+		for( gx++ ; gx < ghost_width ; gx++ )
+			if( ((row[gx/2] >> ((gx & 1) * 4)) & 0xF) != level )
+				break;
+
+		struct ghost_run * const run = &ghost_runs[ ghost_run_count ];
+		run->x0		= ghost_col_x[ start ];
+		run->x1		= ghost_col_x[ gx ];
+		run->color	= ghost_color[ level ];
+
+		if( run->x1 > run->x0 )
+			ghost_run_count++;
+	}
+
+	ghost_run_row = gy;
+}
+
+
+/** Draw the runs of the stored row under BMP row y through the
+ * dither pattern, so that ghost.alpha sixteenths of the pixels are
+ * set and the rest stay transparent.
+ */
+static void
+ghost_span(
+	uint8_t *		row,
+	unsigned		x0,
+	unsigned		x1,
+	unsigned		y,
+	const struct bmp_map *	map
+)
+{
+	unsigned i;
+
+	if( !ghost_width )
+		return;
+
+	if( ghost_col_generation != map->generation )
+		ghost_columns( map );
+
+	const unsigned gy = map->vram_y[y] >> ghost_shift;
+	if( gy >= ghost_height )
+		return;
+
+	if( (int) gy != ghost_run_row )
+		ghost_row_runs( gy );
+
+	for( i=0 ; i<ghost_run_count ; i++ )
+	{
+		const struct ghost_run * const run = &ghost_runs[i];
+		if( run->x1 <= x0 )
+			continue;
+		if( run->x0 >= x1 )
+			break;
+
+		const unsigned a = run->x0 > x0 ? run->x0 : x0;
+		const unsigned b = run->x1 < x1 ? run->x1 : x1;
+
+		span_pattern( row + a, ghost_bits[y & 3][a & 3], b - a, run->color, 0 );
+	}
+}
+
+
+/** Under the zebras and edges, so they still show through */
+static struct overlay_layer ghost_layer = {
+	.name		= "ghost",
+	.z		= 5,
+	.enabled	= &ghost_draw,
+	.span		= ghost_span,
+};
+
+
+static void
+ghost_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		//23456789012
+		"Ghost image: %s",
+		!ghost_draw ? "OFF" : ghost_width ? "ON " : "EMPTY"
+	);
+}
+
+
+static void
+ghost_alpha_toggle( void * priv )
+{
+	ghost_alpha = (ghost_alpha + 4) & 0xF;
+	if( ghost_alpha == 0 )
+		ghost_alpha = 4;
+
+	overlay_lock();
+	ghost_tables();
+	overlay_unlock();
+}
+
+
+static void
+ghost_alpha_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		//23456789012
+		"Ghost alpha: %d%%",
+		(ghost_alpha * 100) / 16
+	);
+}
+
+
+static struct menu_entry ghost_menus[] = {
+	{
+		.priv		= &ghost_draw,
+		.select		= menu_binary_toggle,
+		.display	= ghost_display,
+	},
+	{
+		.priv		= "Capture ghost",
+		.select		= ghost_capture,
+		.display	= menu_print,
+	},
+	{
+		.select		= ghost_alpha_toggle,
+		.display	= ghost_alpha_display,
+	},
+};
+
+
+static void
+ghost_init( void * unused )
+{
+	ghost_tables();
+	menu_add( "Video", ghost_menus, COUNT(ghost_menus) );
+	overlay_register( &ghost_layer );
+}
+
+INIT_FUNC( __FILE__, ghost_init );
@@ -223,10 +223,10 @@ update_lens_display(
 	unsigned x = 620;
 	unsigned y = 0;
 
-	bmp_printf( font, x, y, "%5d mm", info->focal_len );
+	bmp_cell_printf( font, x, y, "%5d mm", info->focal_len );
 
 	y += height;
-	bmp_printf( font, x+12, y,
+	bmp_cell_printf( font, x+12, y,
 		"%s",
 		info->focus_dist == 0xFFFF
 			? " Infnty"
@@ -238,37 +238,37 @@ update_lens_display(
 	x = 0;
 	y = 400;
 	if( info->aperture )
-		bmp_printf( font, x, y,
+		bmp_cell_printf( font, x, y,
 			"f/%2d.%d",
 			info->aperture / 10,
 			info->aperture % 10
 		);
 	else
-		bmp_printf( font_err, x, y,
+		bmp_cell_printf( font_err, x, y,
 			"f 0x%02x",
 			info->raw_aperture
 		);
 
 	x += 100;
 	if( info->shutter )
-		bmp_printf( font, x, y,
+		bmp_cell_printf( font, x, y,
 			"1/%4d",
 			info->shutter
 		);
 	else
-		bmp_printf( font_err, x, y,
+		bmp_cell_printf( font_err, x, y,
 			"f 0x%02x",
 			info->raw_aperture
 		);
 
 	x += 100;
 	if( info->iso )
-		bmp_printf( font, x, y,
+		bmp_cell_printf( font, x, y,
 			"ISO %4d",
 			info->iso
 		);
 	else
-		bmp_printf( font_err, x, y,
+		bmp_cell_printf( font_err, x, y,
 			"ISO 0x%02x",
 			info->raw_iso
 		);
@@ -64,7 +64,7 @@ menu_print(
 	int			selected
 )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		"%s",
@@ -236,7 +236,7 @@ menus_display(
 			COLOR_YELLOW,
 			menu->selected ? 0x7F : COLOR_BG
 		);
-		bmp_printf( fontspec, x, y, "%6s", menu->name );
+		bmp_cell_printf( fontspec, x, y, "%6s", menu->name );
 		x += fontspec_width(fontspec) * 6;
 
 		if( menu->selected )
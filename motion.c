@@ -0,0 +1,323 @@
+/** \file
+ * Motion detection trigger.
+ *
+ * Each LiveView frame is reduced to 8x8 luma blocks with decimate()
+ * and compared against the previous one.  The absolute differences
+ * are summed for each tile of a grid; when enough tiles changed by
+ * more than the threshold a picture is taken.
+ *
+ * At 720x480 the two planes are 90x60 bytes each, so the detector
+ * needs about 11 KB.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "bmp.h"
+#include "menu.h"
+#include "config.h"
+#include "lens.h"
+#include "decimate.h"
+
+#define MOTION_SHIFT		3	//!< 8x reduction
+#define MOTION_TILES_X		8
+#define MOTION_TILES_Y		6
+#define MOTION_TILES		(MOTION_TILES_X * MOTION_TILES_Y)
+
+CONFIG_INT( "motion.trigger",	motion_trigger,	0 );
+CONFIG_INT( "motion.level",	motion_level,	8 );	// mean luma change in a tile
+CONFIG_INT( "motion.tiles",	motion_tiles,	2 );	// tiles that must change
+CONFIG_INT( "motion.holdoff",	motion_holdoff,	3000 );	// ms after a picture
+CONFIG_INT( "motion.poll",	motion_poll,	10 );	// ms between checks
+
+/** Current and reference planes; swapped after every frame */
+static uint8_t *	planes[2];
+static uint8_t *	plane_buf;
+static unsigned		plane_size;
+static int		have_reference;
+
+/** Tile of every column and row of the plane; the rows go up to
+ * the 1088 lines of the HDMI buffer.
+ */
+static uint8_t		tile_x[ DECIMATE_MAX_WIDTH ];
+static uint8_t		tile_y[ BMP_MAP_VRAM_HEIGHT >> MOTION_SHIFT ];
+static uint32_t		tile_sad[ MOTION_TILES ];
+static uint32_t		tile_area[ MOTION_TILES ];
+static unsigned		tile_width;
+static unsigned		tile_height;
+
+/** Last result, for the menu */
+static unsigned		motion_changed;
+static uint32_t		motion_shots;
+
+
+static int
+motion_alloc(
+	const struct vram_info *	vram
+)
+{
+	const unsigned size = decimate_size( vram->width, vram->height, MOTION_SHIFT );
+	if( plane_buf && plane_size >= size )
+		return 1;
+
+	if( plane_buf )
+		free( plane_buf );
+
+	have_reference = 0;
+	plane_size = 0;
+	plane_buf = malloc( 2 * size );
+	if( !plane_buf )
+		return 0;
+
+	planes[0] = plane_buf;
+	planes[1] = plane_buf + size;
+	plane_size = size;
+	return 1;
+}
+
+
+/** Map the plane columns and rows to tiles; only when the size
+ * changes.  Returns 0 if the plane is too big for the tables.
+ */
+static int
+motion_tiles_setup(
+	unsigned		width,
+	unsigned		height
+)
+{
+	unsigned i;
+
+	if( width == tile_width && height == tile_height )
+		return 1;
+
+	if( width > COUNT(tile_x) || height > COUNT(tile_y) )
+		return 0;
+
+	for( i=0 ; i<MOTION_TILES ; i++ )
+		tile_area[i] = 0;
+
+	for( i=0 ; i<width ; i++ )
+		tile_x[i] = (i * MOTION_TILES_X) / width;
+	for( i=0 ; i<height ; i++ )
+		tile_y[i] = (i * MOTION_TILES_Y) / height;
+
+	for( i=0 ; i<width * height ; i++ )
+		tile_area[ tile_y[ i / width ] * MOTION_TILES_X + tile_x[ i % width ] ]++;
+
+	tile_width = width;
+	tile_height = height;
+	have_reference = 0;
+	return 1;
+}
+
+
+/** Sum the absolute differences of each tile and count the tiles
+ * whose mean change is at least motion.level.
+ */
+static unsigned
+motion_compare(
+	const uint8_t *		cur,
+	const uint8_t *		ref,
+	unsigned		width,
+	unsigned		height
+)
+{
+	unsigned x, y, i;
+	unsigned changed = 0;
+
+	for( i=0 ; i<MOTION_TILES ; i++ )
+		tile_sad[i] = 0;
+
+	for( y=0 ; y<height ; y++ )
+	{
+		uint32_t * const row_sad = &tile_sad[ tile_y[y] * MOTION_TILES_X ];
+
+		for( x=0 ; x<width ; x++ )
+		{
+			const int d = *cur++ - *ref++;
+			row_sad[ tile_x[x] ] += d < 0 ? -d : d;
+		}
+	}
+
+	for( i=0 ; i<MOTION_TILES ; i++ )
+		if( tile_sad[i] >= motion_level * tile_area[i] )
+			changed++;
+
+	return changed;
+}
+
+
+/** Wait for the LiveView buffer to flip.  Returns 0 if it did not
+ * within a second.
+ */
+static int
+motion_wait_frame(
+	unsigned *		last
+)
+{
+	unsigned waited;
+	const unsigned poll = motion_poll ? motion_poll : 1;
+
+	for( waited = 0 ; waited < 1000 ; waited += poll )
+	{
+		const unsigned n = vram_get_number(2);
+		if( n != *last )
+		{
+			*last = n;
+			return 1;
+		}
+		msleep( poll );
+	}
+
+	return 0;
+}
+
+
+static void
+motion_task( void * priv )
+{
+	unsigned last = ~0;
+	struct yuv_plane plane;
+
+	msleep( 1000 );
+	while(!shutdown_requested)
+	{
+		if( !motion_trigger || gui_menu_task )
+		{
+			have_reference = 0;
+			msleep( 500 );
+			continue;
+		}
+
+		if( !motion_wait_frame( &last ) )
+		{
+			have_reference = 0;
+			continue;
+		}
+
+		struct vram_info * vram = &vram_info[ last ];
+		if( !vram->vram || !motion_alloc( vram ) )
+			continue;
+
+		plane.shift	= MOTION_SHIFT;
+		plane.luma	= planes[0];
+		plane.u		= NULL;
+		plane.v		= NULL;
+		if( !decimate( vram->vram, vram->width, vram->height, vram->pitch, &plane ) )
+			continue;
+
+		if( !motion_tiles_setup( plane.width, plane.height ) )
+			continue;
+
+		if( have_reference )
+		{
+			motion_changed = motion_compare(
+				planes[0],
+				planes[1],
+				plane.width,
+				plane.height
+			);
+
+			if( motion_changed >= motion_tiles )
+			{
+				DebugMsg( DM_MAGIC, 3, "%s: %d tiles changed",
+					__func__,
+					motion_changed
+				);
+
+				motion_shots++;
+				lens_take_picture( 0 );
+
+				// LiveView blanks for the shot; start over
+				msleep( motion_holdoff );
+				have_reference = 0;
+				continue;
+			}
+		}
+
+		// This frame is the reference for the next one
+		uint8_t * const tmp = planes[0];
+		planes[0] = planes[1];
+		planes[1] = tmp;
+		have_reference = 1;
+	}
+}
+
+TASK_CREATE( __FILE__, motion_task, 0, 0x1f, 0x1000 );
+
+
+static void
+motion_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		//23456789012
+		"Motion trig: %s %d/%d",
+		motion_trigger ? "ON " : "OFF",
+		motion_changed,
+		motion_shots
+	);
+}
+
+
+static void
+motion_level_toggle( void * priv )
+{
+	// 4, 8, 16, 32
+	motion_level = (motion_level * 2) & 0x3F;
+	if( motion_level < 4 )
+		motion_level = 4;
+}
+
+
+static void
+motion_level_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		//23456789012
+		"Motion thrs: %d",
+		motion_level
+	);
+}
+
+
+static struct menu_entry motion_menus[] = {
+	{
+		.priv		= &motion_trigger,
+		.select		= menu_binary_toggle,
+		.display	= motion_display,
+	},
+	{
+		.select		= motion_level_toggle,
+		.display	= motion_level_display,
+	},
+};
+
+
+static void
+motion_init( void * unused )
+{
+	menu_add( "Video", motion_menus, COUNT(motion_menus) );
+}
+
+INIT_FUNC( __FILE__, motion_init );
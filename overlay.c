@@ -0,0 +1,979 @@
+/** \file
+ * LiveView overlay layer registry and scan engine.
+ *
+ * The reserved boxes of all enabled layers are turned into a small
+ * list of horizontal bands.  Each band is a range of rows that share
+ * the same list of spans, and each span is either active (the pixel
+ * layers run) or excluded (only the analysis hooks run).  The lists
+ * are only rebuilt when a layer is enabled, disabled or moved.
+ *
+ * Pixel layers do not write to the BMP VRAM directly.  Each row is
+ * composed into a cached line buffer and compared against a RAM
+ * shadow of what is on screen; only the 32-bit words that changed
+ * are marked dirty and later flushed to the uncached BMP VRAM in
+ * short, rate-limited bursts.
+ *
+ * Span layers draw whole runs of the row with the span.h word fills
+ * before the pixel layers run.  Each one draws into a scratch line
+ * that is merged into the row, and the z of the layer is kept for
+ * every word it drew, so that pixel layers below it are skipped
+ * there and the stacking order holds across both kinds.
+ *
+ * The layout and the scan are in BMP coordinates.  Each BMP row and
+ * column is looked up in the tables from bmp_map_update() to find
+ * the LiveView word under it, so the overlays stay in place on HDMI
+ * where the two buffers have different sizes.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "bmp.h"
+#include "gui.h"
+#include "config.h"
+#include "overlay.h"
+#include "span.h"
+#include "blit.h"
+
+
+// skip the audio meter at the top and the bar at the bottom
+// of a 480 line screen; scaled to the BMP height of the display.
+// 33 is the bottom of the meters; 55 is the crop mark
+#define vram_start_line		33
+#define vram_end_line		390
+#define vram_lines		480
+
+// The edge detector needs a neighbour on each side
+#define vram_edge_margin	2
+
+#define OVERLAY_MAX_WIDTH	1024
+#define OVERLAY_MAX_ROWS	\
+	((vram_end_line - vram_start_line) * BMP_MAX_HEIGHT / vram_lines + 1)
+#define OVERLAY_DIRTY_WORDS	(OVERLAY_MAX_WIDTH / 4 / 32)
+
+#define OVERLAY_MAX_LAYERS	16
+#define OVERLAY_MAX_BANDS	(2 * OVERLAY_MAX_LAYERS + 1)
+#define OVERLAY_MAX_SPANS	(OVERLAY_MAX_BANDS * (2 * OVERLAY_MAX_LAYERS + 3))
+
+/** line_z of a word that no span layer drew */
+#define OVERLAY_Z_NONE		(-0x8000)
+
+
+struct overlay_span
+{
+	uint16_t		x0;
+	uint16_t		x1;
+	uint16_t		active;
+	uint16_t		pad;
+};
+
+struct overlay_band
+{
+	uint16_t		y0;
+	uint16_t		y1;
+	uint16_t		first;		//!< Index into spans[]
+	uint16_t		count;
+};
+
+
+/** Number of BMP words written back to back before pausing,
+ * and the number of nops in the pause.  The old code did one
+ * store and four nops per word to avoid err70.
+ */
+CONFIG_INT( "overlay.flush-burst",	flush_burst,	8 );
+CONFIG_INT( "overlay.flush-gap",	flush_gap,	32 );
+
+/** Time in us that one call to overlay_draw() may spend scanning
+ * before it returns and lets the other tasks run.  0 is no limit.
+ */
+CONFIG_INT( "overlay.tick-budget",	tick_budget,	12000 );
+
+/** Created by the first user; see overlay_sem_get() */
+static struct semaphore *	overlay_sem;
+
+/** Registered layers, sorted by ascending z */
+static struct overlay_layer *	layers;
+static unsigned			layer_count;
+
+/** Pixel layers in the order they are tested, highest z first */
+static struct overlay_layer *	pixel_layers[ OVERLAY_MAX_LAYERS ];
+static unsigned			pixel_count;
+
+/** Span layers in the order they are drawn, lowest z first */
+static struct overlay_layer *	span_layers[ OVERLAY_MAX_LAYERS ];
+static unsigned			span_layer_count;
+
+/** Layout that the span lists were built for */
+static int			layout_dirty = 1;
+static uint32_t			layout_generation;	//!< Of the bmp_map
+static unsigned			layout_width;		//!< BMP size
+static unsigned			layout_height;
+static unsigned			window_y0;		//!< BMP rows scanned
+static unsigned			window_y1;
+static unsigned			layout_enabled[ OVERLAY_MAX_LAYERS ];
+static struct overlay_rect	layout_rect[ OVERLAY_MAX_LAYERS ];
+
+/** Boxes that the blits keep out of.  They are set once the boxes
+ * of the enabled layers have been drawn and cleared as soon as the
+ * boxes may be gone: the layout changes, the scan is aborted or the
+ * menu draws over the screen.
+ */
+static struct overlay_rect	blit_rect[ OVERLAY_MAX_LAYERS ];
+
+static struct overlay_band	bands[ OVERLAY_MAX_BANDS ];
+static unsigned			band_count;
+static struct overlay_span	spans[ OVERLAY_MAX_SPANS ];
+static unsigned			span_count;
+
+/** RAM copy of the scan window of the BMP, layout_width bytes per row.
+ * If it can not be allocated the layers draw straight into the VRAM.
+ */
+static uint8_t *		shadow;
+static unsigned			shadow_width;
+static unsigned			shadow_rows;
+
+/** One bit per 32-bit word of the shadow that differs from the VRAM */
+static uint32_t			dirty[ OVERLAY_MAX_ROWS ][ OVERLAY_DIRTY_WORDS ];
+
+/** Cached line buffer that the pixel layers compose each row into */
+static uint32_t			line[ OVERLAY_MAX_WIDTH / 4 ];
+
+/** Scratch row for one span layer, and the z of the top span layer
+ * that drew each pair of pixels of the row.
+ */
+static uint32_t			span_line[ OVERLAY_MAX_WIDTH / 4 ];
+static int16_t			line_z[ OVERLAY_MAX_WIDTH / 2 ];
+
+/** Position of the frame in progress, so that a scan that runs
+ * out of time can be continued on the next call.
+ */
+static int			scan_running;
+static unsigned			scan_band;
+static unsigned			scan_y;
+static struct overlay_layer *	analysers[ OVERLAY_MAX_LAYERS ];
+static unsigned			analyse_count;
+static unsigned			analyse_vy;		//!< Last VRAM row analysed
+static unsigned			scan_ticks;		//!< Calls so far
+static uint32_t			scan_time;		//!< us so far
+static uint32_t			scan_tick;		//!< Start of the last call
+
+struct overlay_stats		overlay_stats;
+
+
+static inline unsigned
+layer_enabled(
+	const struct overlay_layer *	layer
+)
+{
+	return layer->enabled ? *layer->enabled != 0 : 1;
+}
+
+
+/** The layers register from INIT_FUNCs of other files, which may
+ * run before overlay_init() depending on the link order, so the
+ * semaphore is made by whoever needs it first.  All INIT_FUNCs run
+ * one after the other before any task starts, and overlay_init()
+ * is one of them, so it always exists before there can be a race.
+ */
+static struct semaphore *
+overlay_sem_get( void )
+{
+	if( !overlay_sem )
+		overlay_sem = create_named_semaphore( "overlay", 1 );
+	return overlay_sem;
+}
+
+
+void
+overlay_register(
+	struct overlay_layer *	layer
+)
+{
+	take_semaphore( overlay_sem_get(), 0 );
+
+	if( layer_count >= OVERLAY_MAX_LAYERS )
+	{
+		DebugMsg( DM_MAGIC, 3, "%s: too many layers, dropping %s",
+			__func__,
+			layer->name
+		);
+		goto done;
+	}
+
+	// Insert it sorted by z so that draw() is called bottom up
+	struct overlay_layer ** prev = &layers;
+	while( *prev && (*prev)->z <= layer->z )
+		prev = &(*prev)->next;
+
+	layer->next	= *prev;
+	*prev		= layer;
+	layer_count++;
+	layout_dirty	= 1;
+
+done:
+	give_semaphore( overlay_sem );
+}
+
+
+void
+overlay_lock( void )
+{
+	take_semaphore( overlay_sem_get(), 0 );
+}
+
+
+void
+overlay_unlock( void )
+{
+	give_semaphore( overlay_sem );
+}
+
+
+/** Exclude the boxes that are on screen from the blits, or none */
+static void
+overlay_blit_update(
+	int			shown
+)
+{
+	static const struct overlay_rect none = { 0, 0, 0, 0 };
+	unsigned i;
+
+	for( i=0 ; i<OVERLAY_MAX_LAYERS ; i++ )
+		blit_rect[i] = shown && layout_enabled[i] ? layout_rect[i] : none;
+}
+
+
+void
+overlay_layout_changed( void )
+{
+	layout_dirty = 1;
+	overlay_blit_update( 0 );
+}
+
+
+int
+overlay_active( void )
+{
+	const struct overlay_layer * layer;
+
+	for( layer = layers ; layer ; layer = layer->next )
+		if( layer->enabled && *layer->enabled )
+			return 1;
+
+	return 0;
+}
+
+
+/** Compare the current layer state against the cached layout.
+ * Returns true if the span lists need to be rebuilt.
+ */
+static int
+overlay_layout_check(
+	const struct bmp_map *	map
+)
+{
+	int changed = layout_dirty;
+	unsigned i = 0;
+	const struct overlay_layer * layer;
+
+	if( map->generation != layout_generation )
+		changed = 1;
+
+	layout_generation	= map->generation;
+	layout_width		= map->bmp_width;
+	layout_height		= map->bmp_height;
+
+	for( layer = layers ; layer ; layer = layer->next, i++ )
+	{
+		const unsigned enabled = layer_enabled( layer );
+		struct overlay_rect rect = { 0, 0, 0, 0 };
+
+		if( enabled && layer->reserve )
+			layer->reserve( &rect );
+
+		if( enabled != layout_enabled[i]
+		||  rect.x != layout_rect[i].x
+		||  rect.y != layout_rect[i].y
+		||  rect.w != layout_rect[i].w
+		||  rect.h != layout_rect[i].h
+		)
+			changed = 1;
+
+		layout_enabled[i]	= enabled;
+		layout_rect[i]		= rect;
+	}
+
+	layout_dirty = 0;
+	return changed;
+}
+
+
+static void
+sort_u16(
+	uint16_t *		a,
+	unsigned		n
+)
+{
+	unsigned i, j;
+	for( i=1 ; i<n ; i++ )
+	{
+		const uint16_t v = a[i];
+		for( j=i ; j>0 && a[j-1] > v ; j-- )
+			a[j] = a[j-1];
+		a[j] = v;
+	}
+}
+
+
+/** Append the spans for the rows starting at y0 */
+static unsigned
+overlay_build_row_spans(
+	unsigned		y0,
+	unsigned		width
+)
+{
+	uint16_t x0s[ OVERLAY_MAX_LAYERS + 2 ];
+	uint16_t x1s[ OVERLAY_MAX_LAYERS + 2 ];
+	unsigned n = 0;
+	unsigned i, j;
+
+	// The left and right margins are always excluded
+	x0s[n] = 0;
+	x1s[n++] = vram_edge_margin;
+	x0s[n] = width - vram_edge_margin;
+	x1s[n++] = width;
+
+	for( i=0 ; i<layer_count ; i++ )
+	{
+		const struct overlay_rect * r = &layout_rect[i];
+		if( r->w == 0 || y0 < r->y || y0 >= r->y + r->h )
+			continue;
+
+		// Round out to whole BMP words so that flushing the
+		// shadow never touches a reserved box
+		unsigned x0 = r->x & ~3;
+		unsigned x1 = (r->x + r->w + 3) & ~3;
+		if( x0 >= width )
+			continue;
+		if( x1 > width )
+			x1 = width;
+
+		x0s[n] = x0;
+		x1s[n++] = x1;
+	}
+
+	// Sort the excluded intervals by their start
+	for( i=1 ; i<n ; i++ )
+	{
+		const uint16_t a = x0s[i];
+		const uint16_t b = x1s[i];
+		for( j=i ; j>0 && x0s[j-1] > a ; j-- )
+		{
+			x0s[j] = x0s[j-1];
+			x1s[j] = x1s[j-1];
+		}
+		x0s[j] = a;
+		x1s[j] = b;
+	}
+
+	const unsigned first = span_count;
+	unsigned cursor = 0;
+
+	for( i=0 ; i<n ; )
+	{
+		// Merge any overlapping exclusions
+		unsigned x0 = x0s[i];
+		unsigned x1 = x1s[i];
+		for( i++ ; i<n && x0s[i] <= x1 ; i++ )
+			if( x1s[i] > x1 )
+				x1 = x1s[i];
+
+		if( x0 > cursor )
+		{
+			spans[span_count].x0		= cursor;
+			spans[span_count].x1		= x0;
+			spans[span_count++].active	= 1;
+		}
+
+		if( x0 < cursor )
+			x0 = cursor;
+
+		if( x1 > x0 )
+		{
+			spans[span_count].x0		= x0;
+			spans[span_count].x1		= x1;
+			spans[span_count++].active	= 0;
+			cursor = x1;
+		}
+	}
+
+	if( cursor < width )
+	{
+		spans[span_count].x0		= cursor;
+		spans[span_count].x1		= width;
+		spans[span_count++].active	= 1;
+	}
+
+	return span_count - first;
+}
+
+
+/** Rebuild the band and span lists from the cached layout */
+static void
+overlay_build_spans( void )
+{
+	uint16_t edges[ 2 * OVERLAY_MAX_LAYERS + 2 ];
+	unsigned n = 0;
+	unsigned i;
+
+	const unsigned width	= layout_width;
+	unsigned y_start	= (vram_start_line * layout_height) / vram_lines;
+	unsigned y_end		= (vram_end_line * layout_height) / vram_lines;
+
+	if( y_end > layout_height )
+		y_end = layout_height;
+	if( y_end - y_start > OVERLAY_MAX_ROWS )
+		y_end = y_start + OVERLAY_MAX_ROWS;
+
+	window_y0 = y_start;
+	window_y1 = y_end;
+	band_count = 0;
+	span_count = 0;
+
+	if( width <= 2 * vram_edge_margin || y_start >= y_end )
+		return;
+
+	edges[n++] = y_start;
+	edges[n++] = y_end;
+
+	for( i=0 ; i<layer_count ; i++ )
+	{
+		const struct overlay_rect * r = &layout_rect[i];
+		if( r->w == 0 )
+			continue;
+		if( r->y > y_start && r->y < y_end )
+			edges[n++] = r->y;
+		if( r->y + r->h > y_start && r->y + r->h < y_end )
+			edges[n++] = r->y + r->h;
+	}
+
+	sort_u16( edges, n );
+
+	for( i=0 ; i+1<n ; i++ )
+	{
+		const unsigned y0 = edges[i];
+		const unsigned y1 = edges[i+1];
+		if( y0 == y1 )
+			continue;
+
+		const unsigned first = span_count;
+		const unsigned count = overlay_build_row_spans( y0, width );
+		struct overlay_band * prev = band_count ? &bands[band_count-1] : 0;
+
+		// Coalesce with the band above if the spans are identical
+		if( prev
+		&&  prev->y1 == y0
+		&&  prev->count == count
+		&&  memcmp( &spans[prev->first], &spans[first],
+			count * sizeof(spans[0]) ) == 0
+		) {
+			prev->y1 = y1;
+			span_count = first;
+			continue;
+		}
+
+		bands[band_count].y0	= y0;
+		bands[band_count].y1	= y1;
+		bands[band_count].first	= first;
+		bands[band_count].count	= count;
+		band_count++;
+	}
+
+	// Rebuild the list of pixel layers, highest z first
+	const struct overlay_layer * layer;
+	struct overlay_layer * order[ OVERLAY_MAX_LAYERS ];
+	unsigned count = 0;
+
+	for( layer = layers, i = 0 ; layer ; layer = layer->next, i++ )
+		if( layout_enabled[i] && layer->pixel )
+			order[count++] = (struct overlay_layer *) layer;
+
+	for( i=0 ; i<count ; i++ )
+		pixel_layers[i] = order[count - i - 1];
+	pixel_count = count;
+
+	span_layer_count = 0;
+	for( layer = layers, i = 0 ; layer ; layer = layer->next, i++ )
+		if( layout_enabled[i] && layer->span )
+			span_layers[ span_layer_count++ ] = (struct overlay_layer *) layer;
+
+	DebugMsg( DM_MAGIC, 3, "%s: %d bands, %d spans, %d pixel layers, %d span layers",
+		__func__,
+		band_count,
+		span_count,
+		pixel_count,
+		span_layer_count
+	);
+}
+
+
+/** Clear the shadow and mark the words of the active spans dirty,
+ * so that the next flush rewrites everything the layers own.  The
+ * words of the reserved boxes are never marked, so the flush does
+ * not touch them.
+ */
+static void
+shadow_invalidate( void )
+{
+	uint32_t * d = &dirty[0][0];
+	unsigned i, b, s, y, w;
+
+	for( i=0 ; i<sizeof(dirty)/sizeof(dirty[0][0]) ; i++ )
+		d[i] = 0;
+
+	if( !shadow )
+		return;
+
+	uint32_t * const s_words = (uint32_t*) shadow;
+	for( i=0 ; i<shadow_width * shadow_rows / 4 ; i++ )
+		s_words[i] = 0;
+
+	for( b=0 ; b<band_count ; b++ )
+	{
+		const struct overlay_band * const band = &bands[b];
+		const struct overlay_span * const band_spans = &spans[band->first];
+
+		for( y = band->y0 ; y < band->y1 ; y++ )
+		{
+			uint32_t * const d_row = dirty[ y - window_y0 ];
+
+			for( s=0 ; s<band->count ; s++ )
+			{
+				const struct overlay_span * const span = &band_spans[s];
+				if( !span->active )
+					continue;
+
+				const unsigned w_end = (span->x1 + 3) / 4;
+				for( w = span->x0 / 4 ; w < w_end ; w++ )
+					d_row[ w / 32 ] |= 1 << (w % 32);
+			}
+		}
+	}
+}
+
+
+/** (Re)allocate the shadow for the current scan window */
+static void
+shadow_alloc( void )
+{
+	const unsigned rows = window_y1 > window_y0 ? window_y1 - window_y0 : 0;
+	if( shadow && shadow_width == layout_width && shadow_rows == rows )
+		return;
+
+	if( shadow )
+		free( shadow );
+
+	shadow_width = layout_width;
+	shadow_rows = rows;
+	shadow = 0;
+	if( shadow_width > OVERLAY_MAX_WIDTH || rows == 0 )
+		return;
+
+	shadow = malloc( shadow_width * rows );
+	if( !shadow )
+		DebugMsg( DM_MAGIC, 3, "%s: no shadow, drawing direct", __func__ );
+}
+
+
+/** Compare the composed line against the shadow for the active
+ * spans and mark the words that changed.
+ */
+static void
+shadow_update_row(
+	unsigned			y,
+	const struct overlay_band *	band
+)
+{
+	const struct overlay_span * const band_spans = &spans[band->first];
+	uint32_t * const s_row = (uint32_t*)( shadow + (y - window_y0) * shadow_width );
+	uint32_t * const d_row = dirty[ y - window_y0 ];
+	unsigned s, w;
+
+	for( s=0 ; s<band->count ; s++ )
+	{
+		const struct overlay_span * const span = &band_spans[s];
+		if( !span->active )
+			continue;
+
+		const unsigned w_end = (span->x1 + 3) / 4;
+		for( w = span->x0 / 4 ; w < w_end ; w++ )
+		{
+			const uint32_t v = line[w];
+			if( s_row[w] == v )
+				continue;
+
+			s_row[w] = v;
+			d_row[ w / 32 ] |= 1 << (w % 32);
+		}
+	}
+}
+
+
+/** Write the dirty words of the shadow into the BMP VRAM.
+ *
+ * The uncached BMP VRAM shares bandwidth with the display engine,
+ * so stores are issued in bursts of flush_burst words followed by a
+ * short pause instead of padding every store.
+ */
+static int
+shadow_flush(
+	uint8_t *			bvram,
+	const volatile unsigned *	live
+)
+{
+	const unsigned b_pitch = bmp_pitch();
+	const unsigned words = (shadow_width + 3) / 4;
+	unsigned burst = 0;
+	unsigned y, i;
+
+	for( y=0 ; y<shadow_rows ; y++ )
+	{
+		uint32_t * const d_row = dirty[y];
+		const uint32_t * const s_row = (uint32_t*)( shadow + y * shadow_width );
+		uint32_t * const b_row = (uint32_t*)( bvram + (y + window_y0) * b_pitch );
+
+		if( gui_menu_task || !*live )
+			return 0;
+
+		for( i=0 ; i<OVERLAY_DIRTY_WORDS ; i++ )
+		{
+			uint32_t bits = d_row[i];
+			d_row[i] = 0;
+
+			while( bits )
+			{
+				const unsigned w = i * 32 + __builtin_ctz( bits );
+				bits &= bits - 1;
+
+				if( w >= words )
+					break;
+
+				b_row[w] = s_row[w];
+
+				if( ++burst < flush_burst )
+					continue;
+
+				unsigned gap;
+				for( gap=0 ; gap<flush_gap ; gap++ )
+					asm( "nop" );
+				burst = 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+
+/** Run the span layers over the active spans of BMP row y.  Each
+ * one draws into span_line, which is merged into the row where it
+ * is not 0, and its z is kept for the pairs of pixels that it drew.
+ */
+static void
+overlay_span_row(
+	uint8_t *			row,
+	unsigned			y,
+	const struct overlay_band *	band,
+	const struct bmp_map *		map
+)
+{
+	const struct overlay_span * const band_spans = &spans[band->first];
+	uint16_t * const row16 = (uint16_t*) row;
+	const uint16_t * const scratch16 = (const uint16_t*) span_line;
+	unsigned s, k, p;
+
+	for( s=0 ; s<band->count ; s++ )
+	{
+		const struct overlay_span * const span = &band_spans[s];
+		if( !span->active )
+			continue;
+
+		const unsigned x0 = span->x0;
+		const unsigned x1 = span->x1;
+
+		span_fill( row + x0, x1 - x0, 0 );
+		for( p = x0/2 ; p < x1/2 ; p++ )
+			line_z[p] = OVERLAY_Z_NONE;
+
+		for( k=0 ; k<span_layer_count ; k++ )
+		{
+			struct overlay_layer * const layer = span_layers[k];
+
+			span_fill( (uint8_t*) span_line + x0, x1 - x0, 0 );
+			layer->span( (uint8_t*) span_line, x0, x1, y, map );
+
+			for( p = x0/2 ; p < x1/2 ; p++ )
+			{
+				const uint16_t v = scratch16[p];
+				if( !v )
+					continue;
+
+				const uint16_t mask = 0
+					| ( (v & 0x00FF) ? 0x00FF : 0 )
+					| ( (v & 0xFF00) ? 0xFF00 : 0 );
+
+				row16[p] = (row16[p] & ~mask) | v;
+				line_z[p] = layer->z;
+			}
+		}
+	}
+}
+
+
+/** Start a new frame: run the begin() hooks and rewind the cursor */
+static void
+overlay_scan_begin(
+	struct vram_info *	vram
+)
+{
+	struct overlay_layer * layer;
+	unsigned i;
+
+	analyse_count = 0;
+	for( layer = layers, i = 0 ; layer ; layer = layer->next, i++ )
+	{
+		if( !layout_enabled[i] || !layer->analyse )
+			continue;
+		if( layer->begin && !layer->begin( vram ) )
+			continue;
+		analysers[ analyse_count++ ] = layer;
+	}
+
+	scan_running	= 1;
+	scan_band	= 0;
+	scan_y		= band_count ? bands[0].y0 : 0;
+	analyse_vy	= ~0;
+	scan_ticks	= 0;
+	scan_time	= 0;
+}
+
+
+/** Frame finished; update the refresh statistics */
+static void
+overlay_scan_end(
+	uint32_t		tick_start
+)
+{
+	scan_running = 0;
+	scan_time += digic_timer_elapsed( tick_start );
+
+	overlay_stats.frames++;
+	overlay_stats.ticks		= scan_ticks;
+	overlay_stats.frame_time	= scan_time;
+	overlay_stats.refresh		= scan_time
+		? 100000000 / scan_time
+		: 0;
+}
+
+
+int
+overlay_draw(
+	struct vram_info *	vram,
+	const volatile unsigned * live
+)
+{
+	const uint32_t tick_start = digic_timer();
+	uint8_t * const bvram = bmp_vram();
+	struct overlay_layer * layer;
+	unsigned rows = 0;
+	int rc = OVERLAY_ABORTED;
+	unsigned s, i;
+
+	// If we don't have a bitmap vram yet, nothing to do.
+	if( !bvram || !vram->vram )
+		return OVERLAY_ABORTED;
+
+	take_semaphore( overlay_sem_get(), 0 );
+
+	// Only rebuilt when the display mode or LiveView size changes
+	const struct bmp_map * const map = bmp_map_update( vram );
+	if( !map )
+		goto abort;
+
+	if( overlay_layout_check( map ) )
+	{
+		overlay_blit_update( 0 );
+		overlay_build_spans();
+		shadow_alloc();
+		shadow_invalidate();
+		scan_running = 0;
+	}
+
+	// Continue the frame in progress, or start a new one.  The time
+	// between calls counts towards the frame time.
+	if( !scan_running )
+		overlay_scan_begin( vram );
+	else
+		scan_time += (tick_start - scan_tick) & DIGIC_TIMER_MASK;
+
+	scan_tick = tick_start;
+	scan_ticks++;
+
+	const unsigned v_pitch = vram->pitch / 2;
+	const unsigned b_pitch = bmp_pitch();
+	struct overlay_pixel px;
+	px.vram = vram;
+
+	for( ; scan_band<band_count ; scan_band++ )
+	{
+		const struct overlay_band * const band = &bands[scan_band];
+		const struct overlay_span * const band_spans = &spans[band->first];
+
+		if( scan_y < band->y0 )
+			scan_y = band->y0;
+
+		for( ; scan_y < band->y1 ; scan_y++, rows++ )
+		{
+			// Abort as soon as the new menu is drawn
+			if( gui_menu_task || !*live )
+				goto abort;
+
+			// Out of time for this call; always do at least one row
+			if( rows
+			&&  tick_budget
+			&&  digic_timer_elapsed( tick_start ) >= tick_budget
+			)
+				goto yield;
+
+			px.y = scan_y;
+			px.vy = map->vram_y[ scan_y ];
+
+			const uint32_t * const v_row = (uint32_t*)( vram->vram + px.vy * vram->pitch );
+			const uint32_t * const v_below = v_row + v_pitch;
+			px.b_row = shadow
+				? (uint16_t*) line
+				: (uint16_t*)( bvram + px.y * b_pitch );
+
+			if( span_layer_count )
+				overlay_span_row( (uint8_t*) px.b_row, scan_y, band, map );
+
+			// A BMP larger than the VRAM maps several rows and
+			// columns onto the same word; analyse it only once.
+			const unsigned analyse_row = analyse_count && px.vy != analyse_vy;
+			unsigned analyse_vx = ~0;
+			analyse_vy = px.vy;
+
+			for( s=0 ; s<band->count ; s++ )
+			{
+				const struct overlay_span * const span = &band_spans[s];
+				unsigned x;
+
+				if( !span->active && !analyse_row )
+					continue;
+
+				for( x = span->x0 ; x < span->x1 ; x += 2 )
+				{
+					const unsigned vx = map->vram_x[x];
+					const uint32_t pixel = v_row[ vx/2 ];
+
+					if( analyse_row && vx != analyse_vx )
+					{
+						analyse_vx = vx;
+						for( i=0 ; i<analyse_count ; i++ )
+							analysers[i]->analyse( vx, px.vy, pixel );
+					}
+
+					if( !span->active )
+						continue;
+
+					px.x		= x;
+					px.vx		= vx;
+					px.pixel	= pixel;
+					px.below	= &v_below[ vx/2 ];
+
+					// Layers under a span layer that drew here are hidden
+					const int top = span_layer_count
+						? line_z[ x/2 ]
+						: OVERLAY_Z_NONE;
+
+					for( i=0 ; i<pixel_count ; i++ )
+					{
+						if( pixel_layers[i]->z < top )
+							break;
+						if( pixel_layers[i]->pixel( &px ) )
+							break;
+					}
+
+					// Nobody drew on it, make it clear
+					if( i == pixel_count && top == OVERLAY_Z_NONE )
+						px.b_row[x/2] = 0;
+				}
+			}
+
+			if( shadow )
+				shadow_update_row( px.y, band );
+		}
+	}
+
+	if( shadow && !shadow_flush( bvram, live ) )
+		goto abort;
+
+	for( layer = layers, i = 0 ; layer ; layer = layer->next, i++ )
+		if( layout_enabled[i] && layer->draw )
+			layer->draw();
+
+	overlay_blit_update( 1 );
+	overlay_scan_end( tick_start );
+	rc = OVERLAY_DONE;
+	goto done;
+
+yield:
+	// Put the rows that are finished on screen now
+	if( shadow && !shadow_flush( bvram, live ) )
+		goto abort;
+
+	rc = OVERLAY_MORE;
+	goto done;
+
+abort:
+	// Anything might be drawn over the overlays while we are
+	// not running, so repaint everything on the next frame.
+	layout_dirty = 1;
+	scan_running = 0;
+	overlay_blit_update( 0 );
+
+done:
+	give_semaphore( overlay_sem );
+	return rc;
+}
+
+
+static void
+overlay_init( void * unused )
+{
+	overlay_sem_get();
+
+	// Images are not drawn over the scopes and other boxes
+	unsigned i;
+	for( i=0 ; i<OVERLAY_MAX_LAYERS ; i++ )
+		bmp_blit_exclude( &blit_rect[i] );
+}
+
+INIT_FUNC( __FILE__, overlay_init );
@@ -0,0 +1,209 @@
+#ifndef _overlay_h_
+#define _overlay_h_
+
+/** \file
+ * LiveView overlay layer registry.
+ *
+ * Modules register drawing layers with a stacking order.  The
+ * engine walks the LiveView YUV buffer once per frame and hands
+ * every 32-bit word (two pixels) to the layers that want it.
+ *
+ * The reserved boxes of the enabled layers (histogram, waveform,
+ * timecode and so on) are turned into per-row span lists whenever
+ * the layout changes, so the scan loop never has to do a per-pixel
+ * bounds test to decide which layers to run.
+ *
+ * A frame does not have to be scanned in one call.  Each call to
+ * overlay_draw() processes rows until overlay.tick-budget us have
+ * been used and then returns, so that the overlays do not starve
+ * the other tasks; the next call continues where it left off.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+
+struct bmp_map;
+
+
+/** Screen rectangle in BMP coordinates; w == 0 means no box */
+struct overlay_rect
+{
+	uint16_t		x;
+	uint16_t		y;
+	uint16_t		w;
+	uint16_t		h;
+};
+
+
+/** Everything a pixel layer needs to know about the current word.
+ * The VRAM words are already loaded by the scan loop.
+ *
+ * x and y are BMP coordinates, where the layer draws.  vx and vy are
+ * where the word was read from the LiveView buffer, through the map
+ * from bmp_map_update(); they are the same on the LCD.
+ */
+struct overlay_pixel
+{
+	unsigned		x;		//!< Even BMP column
+	unsigned		y;
+	unsigned		vx;		//!< Even VRAM column
+	unsigned		vy;
+	uint16_t *		b_row;		//!< Output row, index with x/2
+	uint32_t		pixel;		//!< Current YUV word
+	const uint32_t *	below;		//!< Same column, one VRAM row down
+	const struct vram_info * vram;		//!< Buffer being scanned
+};
+
+
+struct overlay_layer
+{
+	const char *		name;
+
+	/** Stacking order; the highest z is tested first and wins. */
+	int			z;
+
+	/** Layer is ignored while *enabled is zero.
+	 * NULL means that the layer is always enabled.
+	 */
+	unsigned *		enabled;
+
+	/** Box on screen that this layer draws into by itself.
+	 * Pixel layers are not run inside reserved boxes.
+	 */
+	void			(*reserve)(
+		struct overlay_rect *	rect
+	);
+
+	/** Called once per frame before the scan.  Return 0 to skip
+	 * the analyse() hook for this frame.
+	 */
+	int			(*begin)(
+		struct vram_info *	vram
+	);
+
+	/** Called for every word in the scan window, including
+	 * the reserved boxes.  Used to gather statistics.  x and y
+	 * are VRAM coordinates.  When the BMP is larger than the
+	 * VRAM a VRAM word still comes here only once per frame.
+	 */
+	void			(*analyse)(
+		unsigned		x,
+		unsigned		y,
+		uint32_t		pixel
+	);
+
+	/** Draws whole runs of a row instead of single words.  Called
+	 * for every active span of each row before the pixel layers,
+	 * lowest z first, with row cleared to 0 from x0 to x1.  The
+	 * layer draws BMP row y into that part of row with the span.h
+	 * primitives; 0 stays transparent.  Pixel layers with a lower
+	 * z do not run on the words that it drew.
+	 */
+	void			(*span)(
+		uint8_t *		row,
+		unsigned		x0,
+		unsigned		x1,
+		unsigned		y,
+		const struct bmp_map *	map
+	);
+
+	/** Called for every word outside the reserved boxes until one
+	 * of the layers returns non-zero.
+	 */
+	unsigned		(*pixel)(
+		const struct overlay_pixel *	px
+	);
+
+	/** Called after the scan, lowest z first, to draw the box */
+	void			(*draw)( void );
+
+	/* Private to the engine */
+	struct overlay_layer *	next;
+};
+
+
+/** Return values of overlay_draw() */
+#define OVERLAY_ABORTED		0	//!< Menu came up or LiveView stopped
+#define OVERLAY_DONE		1	//!< Frame finished and boxes drawn
+#define OVERLAY_MORE		2	//!< Out of time; call again
+
+
+struct overlay_stats
+{
+	uint32_t		frames;		//!< Frames completed
+	uint32_t		ticks;		//!< Calls that the last frame took
+	uint32_t		frame_time;	//!< Last frame, first call to done, in us
+	uint32_t		refresh;	//!< Full frames per second * 100
+};
+
+extern struct overlay_stats overlay_stats;
+
+
+/** Add a layer.  The layer structure must stay valid forever. */
+extern void
+overlay_register(
+	struct overlay_layer *	layer
+);
+
+
+/** Keep overlay_draw() from running, for code outside the overlay
+ * task that changes what the layers read.  Do not hold it for long;
+ * the scan waits for it.
+ */
+extern void
+overlay_lock( void );
+
+extern void
+overlay_unlock( void );
+
+
+/** Force the span lists to be rebuilt and the whole overlay to be
+ * flushed to the BMP VRAM again on the next frame.  Until then the
+ * blits are no longer kept out of the overlay boxes.
+ *
+ * Layout changes that go through reserve() or *enabled are
+ * detected automatically; this is only needed if something else
+ * changed or drew over the overlays, like the menu.
+ */
+extern void
+overlay_layout_changed( void );
+
+
+/** Returns true if any of the registered layers is enabled */
+extern int
+overlay_active( void );
+
+
+/** Run all of the enabled layers over the LiveView buffer.
+ *
+ * Processes rows until the tick budget is used up and returns
+ * OVERLAY_MORE, or finishes the frame, draws the boxes and returns
+ * OVERLAY_DONE.  The scan stops at the start of a row if *live is
+ * zero or the menu comes up and returns OVERLAY_ABORTED; the next
+ * call starts a new frame.
+ */
+extern int
+overlay_draw(
+	struct vram_info *	vram,
+	const volatile unsigned * live
+);
+
+#endif
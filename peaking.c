@@ -0,0 +1,520 @@
+/** \file
+ * Focus peaking engine.
+ *
+ * When the overlay scan reads every VRAM row and column, which is
+ * the case on the LCD, the window is filled by the analyse() hook
+ * from the words that the scan has already loaded and the LiveView
+ * buffer is not read again.  The row below the current one is not
+ * known yet at that point, so the peaks of a row are drawn on the
+ * next one, and one pixel to the right since the kernel needs the
+ * pixel after it.  When the scan skips rows or columns, the first
+ * pixel of a row that reaches the edge layer moves the window down
+ * by reading the next row and computes the whole row; the rest of
+ * the row is then a halfword copy per word.
+ *
+ * In half resolution mode one luma sample is taken per word from
+ * every other row, and each result is written to both pixels of the
+ * word on both rows.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ * Edge detection code by Robert Thiel <rthiel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "bmp.h"
+#include "menu.h"
+#include "config.h"
+#include "swar.h"
+#include "peaking.h"
+
+#define PEAKING_MAX_WIDTH	1024
+
+CONFIG_INT( "edge.kernel",	peaking_kernel,	PEAKING_2TAP );
+CONFIG_INT( "edge.thresh",	peaking_thresh,	0 );	// 0 is adaptive
+CONFIG_INT( "edge.pct",		peaking_pct,	8 );	// percent to mark
+CONFIG_INT( "edge.floor",	peaking_floor,	8 );	// lowest adaptive level
+CONFIG_INT( "edge.half",	peaking_half,	0 );
+
+
+/** Luma rows above, at and below the current row */
+static uint8_t		peaking_luma[3][ PEAKING_MAX_WIDTH ] __attribute__((aligned(8)));
+static uint8_t *	window[3] = {
+	peaking_luma[0],
+	peaking_luma[1],
+	peaking_luma[2],
+};
+static unsigned		window_row = ~0;	//!< Sample row at window[1]
+static unsigned		window_shift;		//!< 1 in half resolution
+
+/** Set for a frame where analyse() fills the window.  window[2] is
+ * then the sample row being read by the scan and window_count the
+ * number of complete rows above it.
+ */
+static unsigned		peaking_direct;
+static unsigned		window_y = ~0;		//!< VRAM row at window[2]
+static unsigned		window_count;
+
+/** BMP colors of the computed row, read as halfwords */
+static uint8_t		peaking_out[ PEAKING_MAX_WIDTH ] __attribute__((aligned(4)));
+static unsigned		out_row = ~0;
+static unsigned		peaking_y = ~0;		//!< Last VRAM row seen
+
+/** Gradients of the frame in progress, for the adaptive threshold */
+static uint32_t		peaking_hist[ 256 ];
+static unsigned		level = 8;
+
+
+static inline int
+peaking_abs(
+	int			x
+)
+{
+	return x < 0 ? -x : x;
+}
+
+
+unsigned
+peaking_level( void )
+{
+	return level;
+}
+
+
+/** Pick the threshold for the next frame and start a new histogram.
+ * The level is the smallest gradient that edge.pct percent of the
+ * samples of the last frame reached.
+ */
+static void
+peaking_frame( void )
+{
+	unsigned i;
+
+	if( peaking_thresh )
+	{
+		level = peaking_thresh > 255 ? 255 : peaking_thresh;
+	} else {
+		uint32_t total = 0;
+		for( i=0 ; i<256 ; i++ )
+			total += peaking_hist[i];
+
+		if( total )
+		{
+			const uint32_t target = (total / 100) * peaking_pct;
+			uint32_t sum = 0;
+
+			for( i=255 ; i>0 ; i-- )
+			{
+				sum += peaking_hist[i];
+				if( sum > target )
+					break;
+			}
+
+			level = i + 1 < peaking_floor ? peaking_floor : i + 1;
+		}
+	}
+
+	for( i=0 ; i<256 ; i++ )
+		peaking_hist[i] = 0;
+
+	window_row = ~0;
+	window_y = ~0;
+	window_count = 0;
+	out_row = ~0;
+	peaking_y = ~0;
+}
+
+
+int
+peaking_begin(
+	struct vram_info *	vram
+)
+{
+	peaking_frame();
+	window_shift = peaking_half ? 1 : 0;
+
+	peaking_direct = bmp_map.generation
+		&& bmp_map.vram_width == vram->width
+		&& bmp_map.vram_height == vram->height
+		&& bmp_map.bmp_width >= vram->width
+		&& bmp_map.bmp_height >= vram->height
+		&& vram->width <= PEAKING_MAX_WIDTH;
+
+	return peaking_direct;
+}
+
+
+void
+peaking_analyse(
+	unsigned		x,
+	unsigned		y,
+	uint32_t		pixel
+)
+{
+	const unsigned shift = window_shift;
+
+	if( y != window_y )
+	{
+		const unsigned r = y >> shift;
+		const unsigned last = window_y >> shift;
+
+		// The second row of a pair in half resolution
+		if( window_y != (unsigned) ~0 && r == last )
+			return;
+
+		uint8_t * const top = window[0];
+		window[0] = window[1];
+		window[1] = window[2];
+		window[2] = top;
+
+		if( window_y != (unsigned) ~0 && r == last + 1 )
+			window_count += window_count < 2;
+		else
+			window_count = 0;
+
+		window_y = y;
+	}
+
+	if( shift )
+	{
+		window[2][ x/2 ] = swar_luma_avg( pixel );
+	} else {
+		const uint32_t luma = swar_luma( pixel );
+		window[2][ x+0 ] = luma & 0xFF;
+		window[2][ x+1 ] = luma >> 16;
+	}
+}
+
+
+/** Read the luma of one sample row from the LiveView buffer */
+static void
+peaking_load(
+	const struct vram_info *	vram,
+	uint8_t *		dst,
+	unsigned		row,
+	unsigned		shift
+)
+{
+	unsigned y = row << shift;
+	if( (int) row < 0 )
+		y = 0;
+	else if( y >= vram->height )
+		y = vram->height - 1;
+
+	const uint32_t * const src = (uint32_t*)( vram->vram + y * vram->pitch );
+	unsigned width = vram->width;
+	if( width > PEAKING_MAX_WIDTH )
+		width = PEAKING_MAX_WIDTH;
+
+	if( !shift )
+	{
+		swar_luma_row( src, dst, width & ~3 );
+		return;
+	}
+
+	unsigned x;
+	for( x=0 ; x<width/2 ; x++ )
+		dst[x] = swar_luma_avg( src[x] );
+}
+
+
+/** Move the window so that window[1] is sample row r.  Only the new
+ * bottom row is read unless the window has to be refilled.
+ */
+static void
+peaking_window(
+	const struct vram_info *	vram,
+	unsigned		r,
+	unsigned		shift
+)
+{
+	if( window_row != (unsigned) ~0
+	&&  r == window_row + 1 )
+	{
+		uint8_t * const top = window[0];
+		window[0] = window[1];
+		window[1] = window[2];
+		window[2] = top;
+		peaking_load( vram, window[2], r + 1, shift );
+	} else {
+		peaking_load( vram, window[0], r - 1, shift );
+		peaking_load( vram, window[1], r, shift );
+		peaking_load( vram, window[2], r + 1, shift );
+	}
+
+	window_row = r;
+}
+
+
+/** Gradient of sample x, 0 to 255, with the selected kernel */
+static inline unsigned
+peaking_gradient(
+	const uint8_t *		n,
+	const uint8_t *		c,
+	const uint8_t *		s,
+	unsigned		x
+)
+{
+	int g;
+
+	switch( peaking_kernel )
+	{
+	case PEAKING_SOBEL:
+	{
+		const int gx = (n[x+1] + 2 * c[x+1] + s[x+1])
+			- (n[x-1] + 2 * c[x-1] + s[x-1]);
+		const int gy = (s[x-1] + 2 * s[x] + s[x+1])
+			- (n[x-1] + 2 * n[x] + n[x+1]);
+		g = (peaking_abs( gx ) + peaking_abs( gy )) >> 3;
+		break;
+	}
+
+	case PEAKING_LAPLACIAN:
+		g = peaking_abs( 4 * c[x] - n[x] - s[x] - c[x-1] - c[x+1] ) >> 2;
+		break;
+
+	default:
+		g = (peaking_abs( c[x] - s[x+1] ) + peaking_abs( c[x+1] - s[x] )) >> 1;
+		break;
+	}
+
+	return g > 255 ? 255 : g;
+}
+
+
+/** Run the kernel over the window and pack the peaks into colors.
+ * Peaks use the blue colors starting at 0x70, brighter for stronger
+ * gradients.
+ */
+static void
+peaking_compute(
+	const struct vram_info *	vram,
+	unsigned		shift
+)
+{
+	const uint8_t * const n = window[0];
+	const uint8_t * const c = window[1];
+	const uint8_t * const s = window[2];
+	const unsigned threshold = level;
+
+	unsigned width = vram->width;
+	if( width > PEAKING_MAX_WIDTH )
+		width = PEAKING_MAX_WIDTH;
+	const unsigned cols = width >> shift;
+	unsigned x;
+
+	uint32_t * const out = (uint32_t*) peaking_out;
+	for( x=0 ; x<width/4 ; x++ )
+		out[x] = 0;
+
+	for( x=1 ; x+1<cols ; x++ )
+	{
+		const unsigned g = peaking_gradient( n, c, s, x );
+		peaking_hist[g]++;
+
+		if( g < threshold )
+			continue;
+
+		const uint8_t color = 0x70 | (g >> 3);
+		if( shift )
+		{
+			peaking_out[ 2*x + 0 ] = color;
+			peaking_out[ 2*x + 1 ] = color;
+		} else
+			peaking_out[ x ] = color;
+	}
+}
+
+
+/** Color of the peak at sample x of window[1], or 0 */
+static inline unsigned
+peaking_sample(
+	unsigned		x
+)
+{
+	const unsigned g = peaking_gradient( window[0], window[1], window[2], x );
+	peaking_hist[g]++;
+
+	return g < level ? 0 : 0x70 | (g >> 3);
+}
+
+
+/** Edge layer from the window that analyse() filled: the previous
+ * sample row, at the sample before this word.  Everything that the
+ * kernel reads of window[2] is already in it.
+ */
+static unsigned
+peaking_pixel_direct(
+	const struct overlay_pixel *	px
+)
+{
+	const unsigned vx = px->vx;
+	uint32_t color;
+
+	if( window_count < 2 || vx < 4 )
+		return 0;
+
+	if( window_shift )
+	{
+		color = peaking_sample( vx/2 - 1 );
+		color |= color << 8;
+	} else
+		color = peaking_sample( vx - 1 ) | (peaking_sample( vx ) << 8);
+
+	if( !color )
+		return 0;
+
+	px->b_row[px->x/2] = color;
+	return 1;
+}
+
+
+unsigned
+peaking_pixel(
+	const struct overlay_pixel *	px
+)
+{
+	if( peaking_direct )
+		return peaking_pixel_direct( px );
+
+	const unsigned y = px->vy;
+
+	if( y != peaking_y )
+	{
+		peaking_y = y;
+
+		const unsigned shift = window_shift;
+		const unsigned r = y >> shift;
+
+		// In half resolution the odd rows repeat the even ones
+		if( r != out_row )
+		{
+			peaking_window( px->vram, r, shift );
+			peaking_compute( px->vram, shift );
+			out_row = r;
+		}
+	}
+
+	if( px->vx >= PEAKING_MAX_WIDTH )
+		return 0;
+
+	const uint32_t color = ((const uint16_t*) peaking_out)[ px->vx / 2 ];
+	if( !color )
+		return 0;
+
+	px->b_row[px->x/2] = color;
+	return 1;
+}
+
+
+static void
+peaking_kernel_toggle( void * priv )
+{
+	peaking_kernel = (peaking_kernel + 1) % PEAKING_KERNELS;
+}
+
+
+static void
+peaking_kernel_display( void * priv, int x, int y, int selected )
+{
+	static const char * names[ PEAKING_KERNELS ] = {
+		"2-tap",
+		"Sobel",
+		"Laplace",
+	};
+
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		//23456789012
+		"Edge kernel: %s",
+		names[ peaking_kernel % PEAKING_KERNELS ]
+	);
+}
+
+
+static void
+peaking_thresh_toggle( void * priv )
+{
+	// AUTO, 16, 32, 64
+	peaking_thresh = peaking_thresh ? (peaking_thresh * 2) & 0x7F : 16;
+	if( peaking_thresh < 16 )
+		peaking_thresh = 0;
+}
+
+
+static void
+peaking_thresh_display( void * priv, int x, int y, int selected )
+{
+	if( peaking_thresh )
+		bmp_cell_printf(
+			selected ? MENU_FONT_SEL : MENU_FONT,
+			x, y,
+			//23456789012
+			"Edge thrs:  %d  ",
+			peaking_thresh
+		);
+	else
+		bmp_cell_printf(
+			selected ? MENU_FONT_SEL : MENU_FONT,
+			x, y,
+			//23456789012
+			"Edge thrs:  AUTO %d",
+			level
+		);
+}
+
+
+static void
+peaking_half_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		//23456789012
+		"Edge res:   %s",
+		*(unsigned*) priv ? "HALF" : "FULL"
+	);
+}
+
+
+static struct menu_entry peaking_menus[] = {
+	{
+		.select		= peaking_kernel_toggle,
+		.display	= peaking_kernel_display,
+	},
+	{
+		.select		= peaking_thresh_toggle,
+		.display	= peaking_thresh_display,
+	},
+	{
+		.priv		= &peaking_half,
+		.select		= menu_binary_toggle,
+		.display	= peaking_half_display,
+	},
+};
+
+
+static void
+peaking_init( void * unused )
+{
+	menu_add( "Video", peaking_menus, COUNT(peaking_menus) );
+}
+
+INIT_FUNC( __FILE__, peaking_init );
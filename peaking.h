@@ -0,0 +1,77 @@
+#ifndef _peaking_h_
+#define _peaking_h_
+
+/** \file
+ * Focus peaking engine.
+ *
+ * The luma of three VRAM rows is kept in a sliding window.  On the
+ * LCD it is filled from the words that the overlay scan reads, so
+ * the LiveView buffer is read only once; otherwise each row is read
+ * once more by the window.  A gradient kernel is run over the window
+ * and the peaks are packed into BMP colors for the edge layer.
+ *
+ * With edge.thresh at zero the threshold follows the gradients of
+ * the previous frame, so low contrast scenes still show peaks.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "overlay.h"
+
+#define PEAKING_2TAP		0	//!< Roberts cross, rows y and y+1
+#define PEAKING_SOBEL		1
+#define PEAKING_LAPLACIAN	2
+#define PEAKING_KERNELS		3
+
+
+/** Start of a frame for the edge layer.  Returns 0, so that the
+ * analyse() hook is not used, if the scan does not read every row
+ * and column of the buffer.
+ */
+extern int
+peaking_begin(
+	struct vram_info *	vram
+);
+
+
+/** Analyse hook for the edge layer; keeps the luma of the words
+ * that the scan reads.
+ */
+extern void
+peaking_analyse(
+	unsigned		x,
+	unsigned		y,
+	uint32_t		pixel
+);
+
+
+/** Pixel hook for the edge layer */
+extern unsigned
+peaking_pixel(
+	const struct overlay_pixel *	px
+);
+
+
+/** Threshold in use, 0 to 255 on the gradient scale */
+extern unsigned
+peaking_level( void );
+
+#endif
@@ -0,0 +1,244 @@
+/** \file
+ * Host check and timing of the span primitives.
+ *
+ * Every primitive is run on random lengths, alignments and burst
+ * settings and compared byte for byte against a plain byte loop,
+ * including the bytes on either side of the span.  Then a 720x480
+ * fill is timed against the original bmp_fill() loop, one word and
+ * four nops at a time, and a font-style pattern against the old
+ * per-bit glyph loop.
+ *
+ *	make span-bench && ./span-bench
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "span.h"
+
+#define BUF_SIZE		4096
+#define CASES			200000
+
+#define SCREEN_WIDTH		720
+#define SCREEN_HEIGHT		480
+#define SCREEN_PITCH		960
+
+
+static double
+now( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static unsigned
+bit(
+	const uint8_t *		bits,
+	unsigned		i
+)
+{
+	return (bits[ i >> 3 ] >> (7 - (i & 7))) & 1;
+}
+
+
+/** Run one random case of primitive op; returns 1 on a mismatch */
+static int
+check_case(
+	unsigned		op
+)
+{
+	static uint8_t got[ BUF_SIZE ] __attribute__((aligned(8)));
+	static uint8_t want[ BUF_SIZE ];
+	static uint8_t src[ BUF_SIZE ];
+	static uint8_t bits[ BUF_SIZE / 8 ];
+	unsigned i;
+
+	const unsigned off = rand() % 64;
+	const unsigned soff = rand() % 64;
+	const unsigned n = rand() % 1000;
+	const uint8_t color = rand();
+	const uint8_t key = rand() % 4;
+	const uint8_t fg = rand();
+	const uint8_t bg = rand();
+
+	for( i=0 ; i<BUF_SIZE ; i++ )
+	{
+		got[i] = want[i] = rand();
+		src[i] = rand() % 4;	// often the key
+	}
+	for( i=0 ; i<sizeof(bits) ; i++ )
+		bits[i] = rand();
+
+	span_burst = rand() % 12;
+	span_gap = rand() % 8;
+
+	switch( op )
+	{
+	case 0:
+		span_fill( got + off, n, color );
+		for( i=0 ; i<n ; i++ )
+			want[off+i] = color;
+		break;
+	case 1:
+		span_copy( got + off, src + soff, n );
+		for( i=0 ; i<n ; i++ )
+			want[off+i] = src[soff+i];
+		break;
+	case 2:
+		span_copy_masked( got + off, src + soff, n, key );
+		for( i=0 ; i<n ; i++ )
+			if( src[soff+i] != key )
+				want[off+i] = src[soff+i];
+		break;
+	default:
+		span_pattern( got + off, bits, n, fg, bg );
+		for( i=0 ; i<n ; i++ )
+			want[off+i] = bit( bits, i ) ? fg : bg;
+		break;
+	}
+
+	if( memcmp( got, want, BUF_SIZE ) == 0 )
+		return 0;
+
+	printf( "op %d off %d src %d n %d burst %d: MISMATCH\n",
+		op, off, soff, n, span_burst );
+	return 1;
+}
+
+
+/** The loop of the original bmp_fill(): whole words only */
+static void
+old_fill(
+	uint8_t *		vram,
+	uint8_t			color
+)
+{
+	const uint32_t word = color * 0x01010101;
+	uint32_t * row = (uint32_t*) vram;
+	unsigned x, y;
+
+	for( y=0 ; y<SCREEN_HEIGHT ; y++, row += SCREEN_PITCH / 4 )
+	{
+		for( x=0 ; x<SCREEN_WIDTH / 4 ; x++ )
+		{
+			row[x] = word;
+			asm( "nop" );
+			asm( "nop" );
+			asm( "nop" );
+			asm( "nop" );
+		}
+	}
+}
+
+
+/** The old glyph loop: background, then one test per bit */
+static void
+old_pattern(
+	uint8_t *		vram,
+	const uint8_t *		bits,
+	uint8_t			fg,
+	uint8_t			bg
+)
+{
+	unsigned x, y;
+
+	for( y=0 ; y<SCREEN_HEIGHT ; y++ )
+	{
+		uint8_t * const row = vram + y * SCREEN_PITCH;
+		for( x=0 ; x<SCREEN_WIDTH ; x++ )
+			row[x] = bg;
+		for( x=0 ; x<SCREEN_WIDTH ; x++ )
+			if( bits[x / 8] & (0x80 >> (x % 8)) )
+				row[x] = fg;
+	}
+}
+
+
+int
+main( void )
+{
+	static uint8_t vram[ SCREEN_PITCH * SCREEN_HEIGHT ] __attribute__((aligned(8)));
+	static uint8_t ref[ SCREEN_PITCH * SCREEN_HEIGHT ];
+	uint8_t bits[ SCREEN_WIDTH / 8 ];
+	const unsigned reps = 100;
+	unsigned i, r, y;
+	int errors = 0;
+
+	srand( 1 );
+	for( i=0 ; i<CASES ; i++ )
+		errors += check_case( i % 4 );
+	printf( "%d random cases, %d mismatches\n", CASES, errors );
+
+	// Alternate pixels, the worst case for the pattern
+	memset( bits, 0xAA, sizeof(bits) );
+
+	span_burst = 8;
+	span_gap = 32;
+
+	double t0 = now();
+	for( r=0 ; r<reps ; r++ )
+		old_fill( ref, r );
+	double t1 = now();
+	for( r=0 ; r<reps ; r++ )
+		for( y=0 ; y<SCREEN_HEIGHT ; y++ )
+			span_fill( vram + y * SCREEN_PITCH, SCREEN_WIDTH, r );
+	double t2 = now();
+
+	if( memcmp( vram, ref, sizeof(vram) ) != 0 )
+	{
+		printf( "fill: MISMATCH against the old loop\n" );
+		errors++;
+	}
+
+	printf( "720x480 fill: old %7.1f us span %7.1f us\n",
+		(t1 - t0) / reps * 1e6,
+		(t2 - t1) / reps * 1e6
+	);
+
+	t0 = now();
+	for( r=0 ; r<reps ; r++ )
+		old_pattern( ref, bits, r, 3 );
+	t1 = now();
+	for( r=0 ; r<reps ; r++ )
+		for( y=0 ; y<SCREEN_HEIGHT ; y++ )
+			span_pattern( vram + y * SCREEN_PITCH, bits, SCREEN_WIDTH, r, 3 );
+	t2 = now();
+
+	if( memcmp( vram, ref, sizeof(vram) ) != 0 )
+	{
+		printf( "pattern: MISMATCH against the old loop\n" );
+		errors++;
+	}
+
+	printf( "720x480 pattern: old %7.1f us span %7.1f us\n",
+		(t1 - t0) / reps * 1e6,
+		(t2 - t1) / reps * 1e6
+	);
+
+	printf( "%d errors\n", errors );
+	return errors != 0;
+}
@@ -0,0 +1,296 @@
+/** \file
+ * Row span primitives for the BMP VRAM.
+ *
+ * The word loops are unrolled four times so that the compiler can
+ * use STM for the stores.  A burst is counted in words stored, so
+ * the masked copy pauses less often when much of the source is the
+ * key color.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "span.h"
+
+unsigned span_burst	= 8;	// words between pauses
+unsigned span_gap	= 32;	// nops in a pause
+
+
+/** Bits to byte masks, the most significant bit to the low byte */
+static const uint32_t span_nibble[ 16 ] = {
+	0x00000000, 0xFF000000, 0x00FF0000, 0xFFFF0000,
+	0x0000FF00, 0xFF00FF00, 0x00FFFF00, 0xFFFFFF00,
+	0x000000FF, 0xFF0000FF, 0x00FF00FF, 0xFFFF00FF,
+	0x0000FFFF, 0xFF00FFFF, 0x00FFFFFF, 0xFFFFFFFF,
+};
+
+
+/** Color in all four bytes of a word */
+static inline uint32_t
+span_word(
+	uint8_t			color
+)
+{
+	return color * 0x01010101;
+}
+
+
+/** Four nops per pass so the loop does not dominate the pause */
+static inline void
+span_pause( void )
+{
+	unsigned i;
+	for( i=0 ; i<span_gap ; i += 4 )
+		asm( "nop\nnop\nnop\nnop\n" );
+}
+
+
+/** Number of words to store before the next pause */
+static inline unsigned
+span_chunk(
+	unsigned		words
+)
+{
+	if( span_burst && words > span_burst )
+		return span_burst;
+	return words;
+}
+
+
+/** Word from four bytes at any alignment */
+static inline uint32_t
+span_load(
+	const uint8_t *		src
+)
+{
+	return 0
+		| src[0] <<  0
+		| src[1] <<  8
+		| src[2] << 16
+		| src[3] << 24;
+}
+
+
+/** 0xFF in each byte of w that is not the key byte */
+static inline uint32_t
+span_key_mask(
+	uint32_t		w,
+	uint32_t		key_word
+)
+{
+	const uint32_t x = w ^ key_word;
+	const uint32_t t = (((x & 0x7F7F7F7F) + 0x7F7F7F7F) | x) & 0x80808080;
+	return (t >> 7) * 0xFF;
+}
+
+
+/** Four pattern bits starting at bit i */
+static inline unsigned
+span_bits4(
+	const uint8_t *		bits,
+	unsigned		i
+)
+{
+	const unsigned shift = i & 7;
+	const uint8_t * const b = bits + (i >> 3);
+	unsigned v = b[0] << 8;
+
+	// Only read the next byte if the bits cross into it
+	if( shift > 4 )
+		v |= b[1];
+
+	return (v >> (12 - shift)) & 0xF;
+}
+
+
+static inline unsigned
+span_bit(
+	const uint8_t *		bits,
+	unsigned		i
+)
+{
+	return (bits[ i >> 3 ] >> (7 - (i & 7))) & 1;
+}
+
+
+void
+span_fill(
+	uint8_t *		dst,
+	unsigned		n,
+	uint8_t			color
+)
+{
+	for( ; n && ((uintptr_t) dst & 3) ; n-- )
+		*dst++ = color;
+
+	const uint32_t word = span_word( color );
+	uint32_t * w = (uint32_t*) dst;
+	unsigned words = n / 4;
+
+	while( words )
+	{
+		unsigned chunk = span_chunk( words );
+		words -= chunk;
+
+		for( ; chunk >= 4 ; chunk -= 4, w += 4 )
+		{
+			w[0] = word;
+			w[1] = word;
+			w[2] = word;
+			w[3] = word;
+		}
+
+		while( chunk-- )
+			*w++ = word;
+
+		if( words )
+			span_pause();
+	}
+
+	dst = (uint8_t*) w;
+	for( n &= 3 ; n ; n-- )
+		*dst++ = color;
+}
+
+
+void
+span_copy(
+	uint8_t *		dst,
+	const uint8_t *		src,
+	unsigned		n
+)
+{
+	for( ; n && ((uintptr_t) dst & 3) ; n-- )
+		*dst++ = *src++;
+
+	const int aligned = ((uintptr_t) src & 3) == 0;
+	uint32_t * w = (uint32_t*) dst;
+	unsigned words = n / 4;
+
+	while( words )
+	{
+		unsigned chunk = span_chunk( words );
+		words -= chunk;
+
+		if( aligned )
+		{
+			const uint32_t * s = (const uint32_t*) src;
+			for( ; chunk >= 4 ; chunk -= 4, w += 4, s += 4 )
+			{
+				w[0] = s[0];
+				w[1] = s[1];
+				w[2] = s[2];
+				w[3] = s[3];
+			}
+
+			while( chunk-- )
+				*w++ = *s++;
+			src = (const uint8_t*) s;
+		} else {
+			for( ; chunk ; chunk--, src += 4 )
+				*w++ = span_load( src );
+		}
+
+		if( words )
+			span_pause();
+	}
+
+	dst = (uint8_t*) w;
+	for( n &= 3 ; n ; n-- )
+		*dst++ = *src++;
+}
+
+
+void
+span_copy_masked(
+	uint8_t *		dst,
+	const uint8_t *		src,
+	unsigned		n,
+	uint8_t			key
+)
+{
+	for( ; n && ((uintptr_t) dst & 3) ; n--, dst++, src++ )
+		if( *src != key )
+			*dst = *src;
+
+	const uint32_t key_word = span_word( key );
+	uint32_t * w = (uint32_t*) dst;
+	unsigned words = n / 4;
+	unsigned burst = 0;
+
+	for( ; words ; words--, w++, src += 4 )
+	{
+		const uint32_t s = span_load( src );
+		const uint32_t mask = span_key_mask( s, key_word );
+
+		if( !mask )
+			continue;
+
+		// Partial words have to read the VRAM back
+		*w = mask == 0xFFFFFFFF ? s : (*w & ~mask) | (s & mask);
+
+		if( ++burst == span_burst )
+		{
+			span_pause();
+			burst = 0;
+		}
+	}
+
+	dst = (uint8_t*) w;
+	for( n &= 3 ; n ; n--, dst++, src++ )
+		if( *src != key )
+			*dst = *src;
+}
+
+
+void
+span_pattern(
+	uint8_t *		dst,
+	const uint8_t *		bits,
+	unsigned		n,
+	uint8_t			fg,
+	uint8_t			bg
+)
+{
+	unsigned i = 0;
+
+	for( ; i < n && ((uintptr_t) dst & 3) ; i++ )
+		*dst++ = span_bit( bits, i ) ? fg : bg;
+
+	const uint32_t bg_word = span_word( bg );
+	const uint32_t diff = bg_word ^ span_word( fg );
+	uint32_t * w = (uint32_t*) dst;
+	unsigned words = (n - i) / 4;
+
+	while( words )
+	{
+		unsigned chunk = span_chunk( words );
+		words -= chunk;
+
+		for( ; chunk ; chunk--, i += 4 )
+			*w++ = bg_word ^ (span_nibble[ span_bits4( bits, i ) ] & diff);
+
+		if( words )
+			span_pause();
+	}
+
+	dst = (uint8_t*) w;
+	for( ; i < n ; i++ )
+		*dst++ = span_bit( bits, i ) ? fg : bg;
+}
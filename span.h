@@ -0,0 +1,90 @@
+#ifndef _span_h_
+#define _span_h_
+
+/** \file
+ * Row span primitives for the BMP VRAM.
+ *
+ * Every primitive writes n bytes starting at any address: single
+ * bytes up to the first word boundary, whole words four at a time
+ * for the body, and single bytes for the tail.  Word stores are
+ * issued in bursts of span.burst words with span.gap nops between
+ * bursts, which replaces the four nops after every store that the
+ * drawing code used to avoid err70.
+ *
+ * span.c only needs <stdint.h> and the two settings below, so the
+ * primitives also build and run on the host; span-bench.c checks
+ * them there against plain byte loops.  On the camera the
+ * settings are the span.burst and span.gap config entries, which
+ * debug.c registers next to the span bench.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+
+/** Words stored between pauses; 0 never pauses */
+extern unsigned span_burst;
+
+/** Nops in each pause */
+extern unsigned span_gap;
+
+
+/** Set n bytes to color */
+extern void
+span_fill(
+	uint8_t *		dst,
+	unsigned		n,
+	uint8_t			color
+);
+
+
+/** Copy n bytes; src need not have the alignment of dst */
+extern void
+span_copy(
+	uint8_t *		dst,
+	const uint8_t *		src,
+	unsigned		n
+);
+
+
+/** Copy n bytes, leaving dst alone where src is the key color */
+extern void
+span_copy_masked(
+	uint8_t *		dst,
+	const uint8_t *		src,
+	unsigned		n,
+	uint8_t			key
+);
+
+
+/** Expand n bits, most significant bit of bits[0] first, to fg
+ * where the bit is set and bg where it is clear.  This is the
+ * layout of the font bitmaps.
+ */
+extern void
+span_pattern(
+	uint8_t *		dst,
+	const uint8_t *		bits,
+	unsigned		n,
+	uint8_t			fg,
+	uint8_t			bg
+);
+
+#endif
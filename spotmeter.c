@@ -1,6 +1,14 @@
 /** \file
  * Measure the intensity of the center few pixels and
  * display a numeric value at the bottom of the screen.
+ *
+ * The overlay scan adds the luma of every word it reads into cells
+ * of 1 << spotmeter.cell-shift pixels, and at the end of the frame
+ * the cells are turned into a summed-area table, so the spot size
+ * and the number of spots do not change the cost and the LiveView
+ * buffer is not read a second time.
+ * Besides the center spot there is a list of spots, given as
+ * "x,y" pairs in percent of the frame, and an N x M grid.
  */
 /*
  * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
@@ -26,9 +34,474 @@
 #include "tasks.h"
 #include "menu.h"
 #include "config.h"
+#include "swar.h"
+#include "overlay.h"
+#include "spotmeter.h"
+
+#define SPOTMETER_MAX_SPOTS	8
+#define SPOTMETER_MAX_GRID	8	//!< Labels overlap beyond this
+#define SPOTMETER_LABEL_CHARS	11	//!< "100% +9.9EV"
 
 CONFIG_INT( "spotmeter.size",		spotmeter_size,	5 );
 CONFIG_INT( "spotmeter.draw",		spotmeter_draw, 0 );
+CONFIG_INT( "spotmeter.mode",		spotmeter_mode,	0 ); // spot, spots, grid
+CONFIG_INT( "spotmeter.cell-shift",	spotmeter_cell_shift, 2 );
+CONFIG_STR( "spotmeter.spots",		spotmeter_spots, "50,50 33,33 67,33 33,67 67,67" );
+CONFIG_INT( "spotmeter.grid-x",		spotmeter_grid_x, 3 );
+CONFIG_INT( "spotmeter.grid-y",		spotmeter_grid_y, 3 );
+
+#define SPOTMETER_MODES		3
+
+
+/** Summed-area table of the cell luma, (cols+1) x (rows+1) with a
+ * zero first row and column.  During the scan the cells are summed
+ * in place and the table is built when the frame is complete.
+ */
+static uint32_t *		sat;
+static unsigned			sat_cols;
+static unsigned			sat_rows;
+static unsigned			sat_shift;
+static unsigned			sat_valid;
+
+/** Samples in each row and column of cells, rows_n[cy+1] and
+ * cols_n[cx+1], turned into running totals with the table.  The
+ * scan reads the same columns on every row that it reads, so the
+ * samples in a rectangle are the product of the two.
+ */
+static uint32_t *		rows_n;
+static uint32_t *		cols_n;
+
+/** Position of the scan in progress */
+static const struct vram_info *	scan_vram;
+static unsigned			scan_y;
+static unsigned			scan_rows;	//!< VRAM rows so far
+static uint32_t *		scan_cells;	//!< Cells of scan_y, or NULL
+
+/** Tenths of an EV from 18% grey for each luma value */
+static const int16_t ev_table[ 256 ] = {
+	-173, -151, -129, -116, -107, -100,  -94,  -89,  -85,  -81,  -78,  -75,  -72,  -70,  -67,  -65,
+	 -63,  -61,  -59,  -58,  -56,  -55,  -53,  -52,  -50,  -49,  -48,  -47,  -45,  -44,  -43,  -42,
+	 -41,  -40,  -39,  -38,  -37,  -37,  -36,  -35,  -34,  -33,  -33,  -32,  -31,  -30,  -30,  -29,
+	 -28,  -28,  -27,  -26,  -26,  -25,  -25,  -24,  -23,  -23,  -22,  -22,  -21,  -21,  -20,  -20,
+	 -19,  -19,  -18,  -18,  -17,  -17,  -16,  -16,  -15,  -15,  -15,  -14,  -14,  -13,  -13,  -12,
+	 -12,  -12,  -11,  -11,  -11,  -10,  -10,   -9,   -9,   -9,   -8,   -8,   -8,   -7,   -7,   -7,
+	  -6,   -6,   -6,   -5,   -5,   -5,   -4,   -4,   -4,   -3,   -3,   -3,   -3,   -2,   -2,   -2,
+	  -1,   -1,   -1,   -1,    0,    0,    0,    1,    1,    1,    1,    2,    2,    2,    2,    3,
+	   3,    3,    3,    4,    4,    4,    4,    5,    5,    5,    5,    5,    6,    6,    6,    6,
+	   7,    7,    7,    7,    7,    8,    8,    8,    8,    9,    9,    9,    9,    9,   10,   10,
+	  10,   10,   10,   11,   11,   11,   11,   11,   11,   12,   12,   12,   12,   12,   13,   13,
+	  13,   13,   13,   14,   14,   14,   14,   14,   14,   15,   15,   15,   15,   15,   15,   16,
+	  16,   16,   16,   16,   16,   17,   17,   17,   17,   17,   17,   18,   18,   18,   18,   18,
+	  18,   18,   19,   19,   19,   19,   19,   19,   19,   20,   20,   20,   20,   20,   20,   20,
+	  21,   21,   21,   21,   21,   21,   21,   22,   22,   22,   22,   22,   22,   22,   23,   23,
+	  23,   23,   23,   23,   23,   23,   24,   24,   24,   24,   24,   24,   24,   24,   25,   25,
+};
+
+
+int
+spotmeter_ev(
+	unsigned		luma
+)
+{
+	return ev_table[ luma & 0xFF ];
+}
+
+
+/** (Re)allocate the table for the size of the LiveView buffer */
+static int
+spotmeter_alloc(
+	const struct vram_info *	vram
+)
+{
+	if( spotmeter_cell_shift < 1 )
+		spotmeter_cell_shift = 1;
+	if( spotmeter_cell_shift > 5 )
+		spotmeter_cell_shift = 5;
+
+	const unsigned shift = spotmeter_cell_shift;
+	const unsigned cols = vram->width >> shift;
+	const unsigned rows = vram->height >> shift;
+
+	if( sat && cols == sat_cols && rows == sat_rows && shift == sat_shift )
+		return 1;
+
+	if( sat )
+		free( sat );
+	if( rows_n )
+		free( rows_n );
+	if( cols_n )
+		free( cols_n );
+
+	sat_valid = 0;
+	sat = malloc( (cols + 1) * (rows + 1) * sizeof(*sat) );
+	rows_n = malloc( (rows + 1) * sizeof(*rows_n) );
+	cols_n = malloc( (cols + 1) * sizeof(*cols_n) );
+	if( !sat || !rows_n || !cols_n )
+	{
+		if( sat )
+			free( sat );
+		if( rows_n )
+			free( rows_n );
+		if( cols_n )
+			free( cols_n );
+		sat = 0;
+		rows_n = 0;
+		cols_n = 0;
+		return 0;
+	}
+
+	sat_cols	= cols;
+	sat_rows	= rows;
+	sat_shift	= shift;
+
+	return 1;
+}
+
+
+/** Start a frame: clear the cells and the sample counts */
+static int
+spotmeter_begin(
+	struct vram_info *	vram
+)
+{
+	if( !spotmeter_alloc( vram ) )
+		return 0;
+
+	const unsigned words = (sat_cols + 1) * (sat_rows + 1);
+	unsigned i;
+
+	sat_valid = 0;
+	for( i=0 ; i<words ; i++ )
+		sat[i] = 0;
+	for( i=0 ; i<=sat_rows ; i++ )
+		rows_n[i] = 0;
+	for( i=0 ; i<=sat_cols ; i++ )
+		cols_n[i] = 0;
+
+	scan_vram	= vram;
+	scan_y		= ~0;
+	scan_rows	= 0;
+	scan_cells	= 0;
+	return 1;
+}
+
+
+/** Add both pixels of a word to its cell.  Words of the partial
+ * cells on the right and bottom edges are dropped.
+ */
+static void
+spotmeter_analyse(
+	unsigned		x,
+	unsigned		y,
+	uint32_t		pixel
+)
+{
+	if( y != scan_y )
+	{
+		const unsigned cy = y >> sat_shift;
+
+		scan_y = y;
+		scan_rows++;
+		scan_cells = 0;
+		if( cy < sat_rows )
+		{
+			scan_cells = &sat[ (cy + 1) * (sat_cols + 1) + 1 ];
+			rows_n[ cy + 1 ]++;
+		}
+	}
+
+	const unsigned cx = x >> sat_shift;
+	if( cx >= sat_cols )
+		return;
+
+	// Every row has the same columns, so count them on the first
+	if( scan_rows == 1 )
+		cols_n[ cx + 1 ] += 2;
+
+	if( !scan_cells )
+		return;
+
+	const uint32_t luma = swar_luma( pixel );
+	scan_cells[ cx ] += (luma & 0xFF) + (luma >> 16);
+}
+
+
+/** Turn the cell sums into the summed-area table, in place, and the
+ * sample counts into running totals.
+ */
+static void
+spotmeter_build( void )
+{
+	const unsigned stride = sat_cols + 1;
+	unsigned cx, cy;
+
+	for( cy=1 ; cy<=sat_rows ; cy++ )
+	{
+		const uint32_t * const above = &sat[ (cy - 1) * stride ];
+		uint32_t * const out = &sat[ cy * stride ];
+		uint32_t row_sum = 0;
+
+		for( cx=1 ; cx<=sat_cols ; cx++ )
+		{
+			row_sum += out[cx];
+			out[cx] = above[cx] + row_sum;
+		}
+	}
+
+	for( cy=1 ; cy<=sat_rows ; cy++ )
+		rows_n[cy] += rows_n[cy-1];
+	for( cx=1 ; cx<=sat_cols ; cx++ )
+		cols_n[cx] += cols_n[cx-1];
+
+	sat_valid = 1;
+}
+
+
+int
+spotmeter_mean(
+	unsigned		x,
+	unsigned		y,
+	unsigned		w,
+	unsigned		h
+)
+{
+	if( !sat || !sat_valid )
+		return -1;
+
+	const unsigned cell = 1 << sat_shift;
+	unsigned x0 = x >> sat_shift;
+	unsigned y0 = y >> sat_shift;
+	unsigned x1 = (x + w + cell - 1) >> sat_shift;
+	unsigned y1 = (y + h + cell - 1) >> sat_shift;
+
+	if( x1 > sat_cols )
+		x1 = sat_cols;
+	if( y1 > sat_rows )
+		y1 = sat_rows;
+	if( x0 >= x1 )
+		x0 = x1 ? x1 - 1 : 0;
+	if( y0 >= y1 )
+		y0 = y1 ? y1 - 1 : 0;
+	if( x0 == x1 || y0 == y1 )
+		return -1;
+
+	// Cells outside of the scan window have no samples
+	const uint32_t count = (rows_n[y1] - rows_n[y0]) * (cols_n[x1] - cols_n[x0]);
+	if( !count )
+		return -1;
+
+	const unsigned stride = sat_cols + 1;
+	const uint32_t sum = sat[ y1 * stride + x1 ]
+		- sat[ y0 * stride + x1 ]
+		- sat[ y1 * stride + x0 ]
+		+ sat[ y0 * stride + x0 ];
+
+	return (sum + count / 2) / count;
+}
+
+
+/** Print the reading for a rectangle as percent and EV */
+static void
+spotmeter_print(
+	unsigned		font,
+	unsigned		x,
+	unsigned		y,
+	int			luma
+)
+{
+	if( luma < 0 )
+		return;
+
+	const int ev = spotmeter_ev( luma );
+	const unsigned ev_abs = ev < 0 ? -ev : ev;
+
+	bmp_printf( font, x, y,
+		"%3d%% %c%d.%dEV",
+		spotmeter_percent( luma ),
+		ev < 0 ? '-' : '+',
+		ev_abs / 10,
+		ev_abs % 10
+	);
+}
+
+
+/** Read the next number from the spot list */
+static const char *
+spotmeter_parse(
+	const char *		s,
+	unsigned *		val
+)
+{
+	while( *s && (*s < '0' || *s > '9') )
+		s++;
+	if( !*s )
+		return 0;
+
+	unsigned v = 0;
+	while( '0' <= *s && *s <= '9' )
+		v = v * 10 + *s++ - '0';
+
+	*val = v > 100 ? 100 : v;
+	return s;
+}
+
+
+/** The map from LiveView to screen pixels, or NULL if it is not
+ * for this buffer.  Called from the overlay task, which keeps it
+ * up to date.
+ */
+static const struct bmp_map *
+spotmeter_map(
+	const struct vram_info *	vram
+)
+{
+	return bmp_map.generation
+		&& bmp_map.vram_width == vram->width
+		&& bmp_map.vram_height == vram->height
+		? &bmp_map : NULL;
+}
+
+
+static unsigned
+spotmeter_bmp_x(
+	const struct bmp_map *	map,
+	unsigned		x
+)
+{
+	if( !map )
+		return x;
+	return map->bmp_x[ x < map->vram_width ? x : map->vram_width - 1 ];
+}
+
+
+static unsigned
+spotmeter_bmp_y(
+	const struct bmp_map *	map,
+	unsigned		y
+)
+{
+	if( !map )
+		return y;
+	return map->bmp_y[ y < map->vram_height ? y : map->vram_height - 1 ];
+}
+
+
+/** Meter the spot around cx,cy in LiveView pixels and mark it on
+ * screen.  The reading goes at tx,ty on screen, or beside the mark
+ * if tx is negative.
+ */
+static void
+spotmeter_draw_spot(
+	const struct vram_info *	vram,
+	unsigned		cx,
+	unsigned		cy,
+	unsigned		font,
+	int			tx,
+	int			ty
+)
+{
+	const unsigned dx = spotmeter_size;
+	if( cx < dx || cy < dx )
+		return;
+
+	const struct bmp_map * const map = spotmeter_map( vram );
+	const unsigned bx0 = spotmeter_bmp_x( map, cx - dx );
+	const unsigned bx1 = spotmeter_bmp_x( map, cx + dx );
+	const unsigned by0 = spotmeter_bmp_y( map, cy - dx );
+	const unsigned by1 = spotmeter_bmp_y( map, cy + dx );
+
+	bmp_fill( 0xA, bx0, by0, bx1 - bx0 + 1, 4 );
+	bmp_fill( 0xA, bx0, by1, bx1 - bx0 + 1, 4 );
+
+	if( tx < 0 )
+	{
+		tx = bx1 + 4;
+		ty = by0;
+	}
+
+	spotmeter_print( font, tx, ty,
+		spotmeter_mean( cx - dx, cy - dx, 2*dx + 1, 2*dx + 1 )
+	);
+}
+
+
+static void
+spotmeter_draw_spots(
+	const struct vram_info *	vram
+)
+{
+	const char * s = spotmeter_spots;
+	unsigned i;
+
+	for( i=0 ; i<SPOTMETER_MAX_SPOTS ; i++ )
+	{
+		unsigned px, py;
+		if( !(s = spotmeter_parse( s, &px )) )
+			break;
+		if( !(s = spotmeter_parse( s, &py )) )
+			break;
+
+		const unsigned cx = (vram->width * px) / 100;
+		const unsigned cy = (vram->height * py) / 100;
+
+		spotmeter_draw_spot( vram, cx, cy, FONT_SMALL, -1, -1 );
+	}
+}
+
+
+static void
+spotmeter_draw_grid(
+	const struct vram_info *	vram
+)
+{
+	const struct bmp_map * const map = spotmeter_map( vram );
+	const unsigned nx = spotmeter_grid_x;
+	const unsigned ny = spotmeter_grid_y;
+	const unsigned w = vram->width / nx;
+	const unsigned h = vram->height / ny;
+	const int label_w = SPOTMETER_LABEL_CHARS * fontspec_width( FONT_SMALL );
+	const int label_h = fontspec_height( FONT_SMALL );
+	const int max_x = (int) bmp_width() - label_w;
+	const int max_y = (int) bmp_height() - label_h;
+	unsigned gx, gy;
+
+	for( gy=0 ; gy<ny ; gy++ )
+	{
+		for( gx=0 ; gx<nx ; gx++ )
+		{
+			// Centre the label on the cell, but keep it on screen
+			int x = (int) spotmeter_bmp_x( map, gx * w + w/2 ) - label_w / 2;
+			int y = (int) spotmeter_bmp_y( map, gy * h + h/2 ) - label_h / 2;
+			if( x > max_x )
+				x = max_x;
+			if( x < 0 )
+				x = 0;
+			if( y > max_y )
+				y = max_y;
+			if( y < 0 )
+				y = 0;
+
+			spotmeter_print( FONT_SMALL, x, y,
+				spotmeter_mean( gx * w, gy * h, w, h )
+			);
+		}
+	}
+}
+
+
+/** Keep the grid size from the config file in range */
+static void
+spotmeter_grid_clamp( void )
+{
+	if( spotmeter_grid_x < 1 )
+		spotmeter_grid_x = 1;
+	if( spotmeter_grid_x > SPOTMETER_MAX_GRID )
+		spotmeter_grid_x = SPOTMETER_MAX_GRID;
+	if( spotmeter_grid_y < 1 )
+		spotmeter_grid_y = 1;
+	if( spotmeter_grid_y > SPOTMETER_MAX_GRID )
+		spotmeter_grid_y = SPOTMETER_MAX_GRID;
+}
 
 
 static void
@@ -41,7 +514,7 @@ spotmeter_menu_display(
 {
 	int * draw_ptr = priv;
 
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -51,6 +524,35 @@ spotmeter_menu_display(
 }
 
 
+static void
+spotmeter_mode_toggle( void * priv )
+{
+	unsigned * ptr = priv;
+	*ptr = (*ptr + 1) % SPOTMETER_MODES;
+}
+
+
+static void
+spotmeter_mode_display(
+	void *			priv,
+	int			x,
+	int			y,
+	int			selected
+)
+{
+	static const char * modes[] = { "SPOT ", "SPOTS", "GRID " };
+	unsigned mode = *(unsigned*) priv;
+
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		//23456789012
+		"Meter mode: %s",
+		modes[ mode < SPOTMETER_MODES ? mode : 0 ]
+	);
+}
+
+
 static void
 spotmeter_clear_display( void * priv )
 {
@@ -70,73 +572,66 @@ static struct menu_entry spotmeter_menus[] = {
 		.select			= menu_binary_toggle,
 		.display		= spotmeter_menu_display,
 	},
+	{
+		.priv			= &spotmeter_mode,
+		.select			= spotmeter_mode_toggle,
+		.display		= spotmeter_mode_display,
+	},
 };
 
 
+/** The frame is complete; build the table and draw the readings */
 static void
-spotmeter_task( void * priv )
+spotmeter_draw_layer( void )
 {
-	menu_add( "Video", spotmeter_menus, COUNT(spotmeter_menus) );
+	// Nothing if begin() did not run for this frame
+	const struct vram_info * const vram = scan_vram;
+	scan_vram = 0;
+	if( !vram || !sat )
+		return;
 
-	msleep( 1000 );
-	while(!shutdown_requested)
-	{
-		// Draw a few pixels to indicate the center
-		if( !spotmeter_draw )
-		{
-			msleep( 1000 );
-			continue;
-		}
+	spotmeter_build();
 
-		msleep( 100 );
-
-		struct vram_info *	vram = &vram_info[ vram_get_number(2) ];
-		if( !vram->vram )
-			continue;
-
-		const unsigned		width = vram->width;
-		const unsigned		pitch = vram->pitch;
-		const unsigned		height = vram->height;
-		const unsigned		dx = spotmeter_size;
-		unsigned		sum = 0;
-		unsigned		x, y;
-
-		bmp_fill(
-			0xA,
-			width/2 - dx,
-			height/2 - dx,
-			2*dx + 1,
-			4
+	switch( spotmeter_mode )
+	{
+	case 1:
+		spotmeter_draw_spots( vram );
+		break;
+	case 2:
+		spotmeter_draw_grid( vram );
+		break;
+	default:
+		spotmeter_draw_spot( vram,
+			vram->width / 2,
+			vram->height / 2,
+			FONT_MED,
+			300,
+			400
 		);
+		break;
+	}
+}
 
-		bmp_fill(
-			0xA,
-			width/2 - dx,
-			height/2 + dx,
-			2*dx + 1,
-			4
-		);
 
-		// Sum the values around the center
-		for( y = height/2 - dx ; y <= height/2 + dx ; y++ )
-		{
-			for( x = width/2 - dx ; x <= width/2 + dx ; x++ )
-				sum += vram->vram[ x + y * pitch ];
-		}
+/** Gathers its cells in the overlay scan; it draws straight to the
+ * screen, so it has no box of its own.
+ */
+static struct overlay_layer spotmeter_layer = {
+	.name		= "spotmeter",
+	.z		= 50,
+	.enabled	= &spotmeter_draw,
+	.begin		= spotmeter_begin,
+	.analyse	= spotmeter_analyse,
+	.draw		= spotmeter_draw_layer,
+};
 
-		sum /= (2 * dx + 1) * (2 * dx + 1);
 
-		// Scale to 100%
-		const unsigned		scaled = (100 * sum) / 65536;
-		bmp_printf(
-			FONT_MED,
-			300,
-			400,
-			"%3d%%",
-			scaled
-		);
-	}
+static void
+spotmeter_task( void * priv )
+{
+	menu_add( "Video", spotmeter_menus, COUNT(spotmeter_menus) );
+	spotmeter_grid_clamp();
+	overlay_register( &spotmeter_layer );
 }
 
 TASK_CREATE( __FILE__, spotmeter_task, 0, 0x1f, 0x1000 );
-			
@@ -0,0 +1,65 @@
+#ifndef _spotmeter_h_
+#define _spotmeter_h_
+
+/** \file
+ * Spot, multi-spot and grid metering from a summed-area table.
+ *
+ * The overlay scan sums the luma of the LiveView buffer into cells
+ * and at the end of each frame a summed-area table is built over
+ * them.  The mean of any rectangle is then four lookups, no matter
+ * how large it is.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+
+
+/** Mean luma, 0 to 255, of a rectangle in LiveView pixels.
+ * The rectangle is rounded out to whole cells.  Returns -1 if there
+ * is no table yet or the rectangle is outside of the scan window.
+ * Only valid in the overlay task.
+ */
+extern int
+spotmeter_mean(
+	unsigned		x,
+	unsigned		y,
+	unsigned		w,
+	unsigned		h
+);
+
+
+/** Luma to percent of full scale */
+static inline unsigned
+spotmeter_percent(
+	unsigned		luma
+)
+{
+	return (luma * 100 + 127) / 255;
+}
+
+
+/** Luma to tenths of an EV from middle grey, assuming a 2.2 gamma */
+extern int
+spotmeter_ev(
+	unsigned		luma
+);
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef _swar_h_
+#define _swar_h_
+
+/** \file
+ * SIMD-within-a-register kernels for the LiveView YUV buffer.
+ *
+ * The LiveView VRAM is packed UYVY: each 32-bit word holds two
+ * pixels as U, Y0, V, Y1 from the low byte up.  Treating the 16-bit
+ * halves as brightness values mixes the chroma into the low byte,
+ * so these kernels extract the luma first.
+ *
+ * The luma of the two pixels is kept in two 16-bit lanes of a word,
+ * 0x00YY00YY, with Y0 in the low lane.  The empty high byte of each
+ * lane is the guard that lets adds, subtracts and compares run on
+ * both pixels at once without carries leaking into the neighbour.
+ * The row kernels load two words at a time (LDRD on the ARM) and
+ * work on four pixels per iteration.
+ *
+ * Everything here is plain C that also builds on the host, except
+ * for the few places where an ARMv5TE DSP instruction is a clear
+ * win; those have a C fallback.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+
+#define SWAR_LANES		0x00010001	//!< One in each lane
+#define SWAR_LANE_MASK		0x00FF00FF	//!< Value bits of each lane
+#define SWAR_GUARD		0x01000100	//!< Carry bit above each lane
+#define SWAR_WIDE_GUARD		0x80008000	//!< Sign bit of each wide lane
+
+
+/** Load two VRAM words (four pixels) with one LDRD.
+ * p must be 8-byte aligned.
+ */
+static inline void
+swar_load4(
+	const uint32_t *	p,
+	uint32_t *		w0,
+	uint32_t *		w1
+)
+{
+#if defined(__ARM_ARCH_5TE__) && !defined(__thumb__)
+	uint64_t d;
+	asm( "ldrd %0, %H0, [%1]" : "=r"(d) : "r"(p) : "memory" );
+	*w0 = (uint32_t) d;
+	*w1 = (uint32_t)( d >> 32 );
+#else
+	*w0 = p[0];
+	*w1 = p[1];
+#endif
+}
+
+
+/** Luma of both pixels in a UYVY word as 0x00Y100Y0 */
+static inline uint32_t
+swar_luma(
+	uint32_t		w
+)
+{
+	return (w >> 8) & SWAR_LANE_MASK;
+}
+
+
+/** Luma of the two pixels packed into bytes, 0xY1Y0 */
+static inline uint32_t
+swar_luma_bytes(
+	uint32_t		w
+)
+{
+	const uint32_t y = swar_luma( w );
+	return (y | (y >> 8)) & 0xFFFF;
+}
+
+
+/** Average luma of the two pixels in a word, 0 to 255 */
+static inline uint32_t
+swar_luma_avg(
+	uint32_t		w
+)
+{
+	const uint32_t y = swar_luma( w );
+	return ((y & 0xFF) + (y >> 16)) >> 1;
+}
+
+
+/** Replicate an 8-bit value into both lanes */
+static inline uint32_t
+swar_splat(
+	uint32_t		v
+)
+{
+	return (v & 0xFF) * SWAR_LANES;
+}
+
+
+/** Compare both lanes against a threshold.
+ * Returns 0x00FF00FF with the lane set where y >= t.
+ * t must be in the range 1 to 255.
+ */
+static inline uint32_t
+swar_ge(
+	uint32_t		y,
+	uint32_t		t
+)
+{
+	// Adding 256 - t carries into the guard bit iff y >= t
+	const uint32_t carry = (y + swar_splat( 256 - t )) & SWAR_GUARD;
+	return (carry >> 8) * 0xFF;
+}
+
+
+/** Dual threshold zebra test for both pixels of a UYVY word.
+ *
+ * Sets *over to the lanes with luma >= hi and *under to the lanes
+ * with luma < lo.  A threshold of 0 disables that side.
+ * Returns non-zero if either pixel is flagged.
+ */
+static inline uint32_t
+swar_zebra(
+	uint32_t		w,
+	uint32_t		hi,
+	uint32_t		lo,
+	uint32_t *		over,
+	uint32_t *		under
+)
+{
+	const uint32_t y = swar_luma( w );
+	*over = hi ? swar_ge( y, hi ) : 0;
+	*under = lo ? swar_ge( y, lo ) ^ SWAR_LANE_MASK : 0;
+	return *over | *under;
+}
+
+
+/** Turn a lane mask (0x00FF00FF style) into a 16-bit mask that
+ * covers the two BMP bytes of the pixels, 0xFFFF style.
+ */
+static inline uint32_t
+swar_mask_bytes(
+	uint32_t		mask
+)
+{
+	return (mask | (mask >> 8)) & 0xFFFF;
+}
+
+
+/** Absolute difference of each lane, |a - b|.
+ * Lanes must be 8-bit values.
+ */
+static inline uint32_t
+swar_absdiff(
+	uint32_t		a,
+	uint32_t		b
+)
+{
+	// Bias each lane by 256 so that the subtract can not borrow
+	// from the lane above; the guard bit is then set iff a >= b.
+	const uint32_t t = (a | SWAR_GUARD) - b;
+	const uint32_t neg = ((~t & SWAR_GUARD) >> 8);	// 1 where a < b
+	const uint32_t v = t & SWAR_LANE_MASK;
+	return (v ^ (neg * 0xFF)) + neg;
+}
+
+
+/** Shift the lanes one pixel to the right: the low lane gets the
+ * right pixel of w and the high lane the left pixel of next.
+ */
+static inline uint32_t
+swar_right(
+	uint32_t		y,
+	uint32_t		y_next
+)
+{
+	return (y >> 16) | (y_next << 16);
+}
+
+
+/** Roberts cross gradient of the two pixels of a word.
+ *
+ * w and w_next are the current and following words on this row,
+ * b and b_next the same columns on the row below.  Returns the
+ * sum of the two diagonal absolute differences, 0 to 510, in two
+ * 16-bit lanes.
+ */
+static inline uint32_t
+swar_gradient(
+	uint32_t		w,
+	uint32_t		w_next,
+	uint32_t		b,
+	uint32_t		b_next
+)
+{
+	const uint32_t y	= swar_luma( w );
+	const uint32_t yr	= swar_right( y, swar_luma( w_next ) );
+	const uint32_t yb	= swar_luma( b );
+	const uint32_t ybr	= swar_right( yb, swar_luma( b_next ) );
+
+	return swar_absdiff( y, ybr ) + swar_absdiff( yr, yb );
+}
+
+
+/** Compare two wide lanes (values up to 0x7FFF) against t.
+ * Returns 0xFFFFFFFF style lane masks where v >= t.
+ */
+static inline uint32_t
+swar_ge_wide(
+	uint32_t		v,
+	uint32_t		t
+)
+{
+	const uint32_t sign = (v + (0x8000 - t) * SWAR_LANES) & SWAR_WIDE_GUARD;
+	return (sign >> 15) * 0xFFFF;
+}
+
+
+/** Scale the luma lanes to n bins, (y * n) >> 8, and return the bin
+ * of the low pixel in the low half and the high pixel in the high
+ * half.  Uses the 16x16 DSP multiplies on the ARM.
+ */
+static inline uint32_t
+swar_bins(
+	uint32_t		y,
+	uint32_t		n
+)
+{
+#if defined(__ARM_ARCH_5TE__) && !defined(__thumb__)
+	uint32_t b0, b1;
+	asm( "smulbb %0, %1, %2" : "=r"(b0) : "r"(y), "r"(n) );
+	asm( "smultb %0, %1, %2" : "=r"(b1) : "r"(y), "r"(n) );
+	return (b0 >> 8) | ((b1 >> 8) << 16);
+#else
+	return (((y & 0xFF) * n) >> 8) | ((((y >> 16) * n) >> 8) << 16);
+#endif
+}
+
+
+/** Bin of each lane for a power of two number of bins, 1 << bits */
+static inline uint32_t
+swar_bins_pow2(
+	uint32_t		y,
+	unsigned		bits
+)
+{
+	return (y >> (8 - bits)) & (SWAR_LANES * ((1 << bits) - 1));
+}
+
+
+/** Extract the luma of a row of UYVY pixels into packed bytes.
+ *
+ * Four pixels per iteration; width is in pixels and must be a
+ * multiple of four, and src and dst must be 8 and 4 byte aligned.
+ */
+static inline void
+swar_luma_row(
+	const uint32_t *	src,
+	uint8_t *		dst,
+	unsigned		width
+)
+{
+	uint32_t * out = (uint32_t*) dst;
+	unsigned x;
+
+	for( x=0 ; x<width ; x += 4, src += 2 )
+	{
+		uint32_t w0, w1;
+		swar_load4( src, &w0, &w1 );
+		*out++ = swar_luma_bytes( w0 ) | (swar_luma_bytes( w1 ) << 16);
+	}
+}
+
+#endif
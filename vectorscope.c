@@ -0,0 +1,285 @@
+/** \file
+ * U/V vectorscope.
+ *
+ * The chroma of one word in four of the overlay scan goes into a
+ * 64 x 64 grid of saturating byte counters, 4 KB in all.  Each UYVY
+ * word has one U and one V byte that are shared by its two pixels.
+ * The LiveView chroma is signed and centred on 0; it is offset by
+ * 128 for binning, so neutral is the middle of the box.  Counts are
+ * drawn on a square root scale so that the density still shows
+ * where most bins are well filled.
+ *
+ * The box is 128 x 128 pixels with each bin drawn as 2 x 2.  The
+ * graticule (the axes, the 75% saturation ring and the 75% colour
+ * bar targets) is rendered once into a lookup image, so drawing the
+ * scope is one table lookup per pixel and whole-word stores.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "bmp.h"
+#include "menu.h"
+#include "config.h"
+#include "overlay.h"
+#include "span.h"
+
+#define vectorscope_bins		64	//!< Bins on each axis
+#define vectorscope_size		128	//!< Box size in pixels
+#define vectorscope_shift		2	//!< Chroma byte to bin
+#define vectorscope_sample		3	//!< Analyse one word in four
+
+#define vectorscope_grat_axis		0x30	//!< Dark grey
+#define vectorscope_grat_ring		0x38
+#define vectorscope_grat_target		COLOR_WHITE
+
+CONFIG_INT( "vectorscope.draw",	vectorscope_draw,	0 );
+CONFIG_INT( "vectorscope.x",	vectorscope_x,		8 );
+CONFIG_INT( "vectorscope.y",	vectorscope_y,		240 );
+CONFIG_INT( "vectorscope.bg",	vectorscope_bg,		0x26 ); // solid black
+
+
+/** Chroma bins, V rows by U columns */
+static uint8_t		vectorscope[ vectorscope_bins * vectorscope_bins ];
+
+/** Graticule image, or the background where there is none */
+static uint8_t *	graticule;
+static unsigned		graticule_bg = ~0;
+
+/** Count to grey level */
+static uint8_t		vectorscope_lut[ 256 ];
+
+
+/** Cb and Cr of the 75% colour bars, BT.601 with the 128 offset */
+static const uint8_t vectorscope_targets[][2] = {
+	{ 100, 212 },	// red
+	{  44, 142 },	// yellow
+	{  72,  58 },	// green
+	{ 156,  44 },	// cyan
+	{ 212, 114 },	// blue
+	{ 184, 198 },	// magenta
+};
+
+
+static inline int
+iabs(
+	int			x
+)
+{
+	return x < 0 ? -x : x;
+}
+
+
+/** Render the graticule image.  Screen x is U to the right and screen
+ * y is V up, both centered on the neutral value of 128.
+ */
+static int
+vectorscope_graticule( void )
+{
+	if( graticule && graticule_bg == vectorscope_bg )
+		return 1;
+
+	if( !graticule )
+		graticule = malloc( vectorscope_size * vectorscope_size );
+	if( !graticule )
+		return 0;
+
+	// The ring goes through the targets; red is as good as any
+	const int ring_du = vectorscope_targets[0][0] - 128;
+	const int ring_dv = vectorscope_targets[0][1] - 128;
+	const int ring = ring_du * ring_du + ring_dv * ring_dv;
+	const int ring_width = 2 * 88 * 2;	// about one bin either side
+
+	unsigned x, y, t;
+
+	for( y=0 ; y<vectorscope_size ; y++ )
+	{
+		uint8_t * const row = &graticule[ y * vectorscope_size ];
+		const int dv = (int)( vectorscope_size - 1 - y ) * 2 - 128;
+
+		for( x=0 ; x<vectorscope_size ; x++ )
+		{
+			const int du = (int) x * 2 - 128;
+			const int r = du * du + dv * dv;
+			uint8_t color = vectorscope_bg;
+
+			if( du == 0 || dv == 0 )
+				color = vectorscope_grat_axis;
+			if( iabs( r - ring ) < ring_width )
+				color = vectorscope_grat_ring;
+
+			row[x] = color;
+		}
+	}
+
+	// Small open boxes around the colour bar targets
+	for( t=0 ; t<COUNT(vectorscope_targets) ; t++ )
+	{
+		const int cx = vectorscope_targets[t][0] / 2;
+		const int cy = vectorscope_size - 1 - vectorscope_targets[t][1] / 2;
+		int i;
+
+		for( i=-3 ; i<=3 ; i++ )
+		{
+			graticule[ (cy - 3) * vectorscope_size + cx + i ] = vectorscope_grat_target;
+			graticule[ (cy + 3) * vectorscope_size + cx + i ] = vectorscope_grat_target;
+			graticule[ (cy + i) * vectorscope_size + cx - 3 ] = vectorscope_grat_target;
+			graticule[ (cy + i) * vectorscope_size + cx + 3 ] = vectorscope_grat_target;
+		}
+	}
+
+	// Square root scale: grey level g for counts from (g/41)^2 * 255
+	unsigned g = 0;
+	for( x=1 ; x<256 ; x++ )
+	{
+		while( g < 41 && (g + 1) * (g + 1) * 255 <= x * 41 * 41 )
+			g++;
+		vectorscope_lut[x] = 0x27 + g;
+	}
+
+	graticule_bg = vectorscope_bg;
+	return 1;
+}
+
+
+static int
+vectorscope_begin(
+	struct vram_info *	vram
+)
+{
+	if( !vectorscope_graticule() )
+		return 0;
+
+	uint32_t * const bins = (uint32_t*) vectorscope;
+	unsigned i;
+	for( i=0 ; i<sizeof(vectorscope)/4 ; i++ )
+		bins[i] = 0;
+
+	return 1;
+}
+
+
+static void
+vectorscope_analyse(
+	unsigned		x,
+	unsigned		y,
+	uint32_t		pixel
+)
+{
+	// Spread the samples over the rows so the pattern does not alias
+	if( ((x >> 1) + y) & vectorscope_sample )
+		return;
+
+	const unsigned u = (int8_t)( pixel >>  0 ) + 128;
+	const unsigned v = (int8_t)( pixel >> 16 ) + 128;
+	uint8_t * const bin = &vectorscope[
+		((v >> vectorscope_shift) << 6) | (u >> vectorscope_shift)
+	];
+
+	const unsigned count = *bin;
+	if( count != 0xFF )
+		*bin = count + 1;
+}
+
+
+static void
+vectorscope_reserve(
+	struct overlay_rect *	rect
+)
+{
+	rect->x = vectorscope_x;
+	rect->y = vectorscope_y;
+	rect->w = vectorscope_size;
+	rect->h = vectorscope_size;
+}
+
+
+/** Draw the scope, top row (highest V) first */
+static void
+vectorscope_draw_layer( void )
+{
+	static uint8_t line[ vectorscope_size ] __attribute__((aligned(4)));
+	uint8_t * const bvram = bmp_vram();
+	const unsigned pitch = bmp_pitch();
+	unsigned x, y;
+
+	if( !graticule )
+		return;
+
+	uint8_t * row = bvram + vectorscope_x + vectorscope_y * pitch;
+
+	for( y=0 ; y<vectorscope_size ; y++, row += pitch )
+	{
+		const unsigned v_bin = (vectorscope_size - 1 - y) >> 1;
+		const uint8_t * const bins = &vectorscope[ v_bin * vectorscope_bins ];
+		const uint8_t * const grat = &graticule[ y * vectorscope_size ];
+
+		for( x=0 ; x<vectorscope_size ; x++ )
+		{
+			const unsigned count = bins[ x >> 1 ];
+			line[x] = count ? vectorscope_lut[ count ] : grat[x];
+		}
+
+		span_copy( row, line, vectorscope_size );
+	}
+}
+
+
+static struct overlay_layer vectorscope_layer = {
+	.name		= "vectorscope",
+	.z		= 120,
+	.enabled	= &vectorscope_draw,
+	.reserve	= vectorscope_reserve,
+	.begin		= vectorscope_begin,
+	.analyse	= vectorscope_analyse,
+	.draw		= vectorscope_draw_layer,
+};
+
+
+static void
+vectorscope_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		//23456789012
+		"Vectorscope: %s",
+		*(unsigned*) priv ? "ON " : "OFF"
+	);
+}
+
+
+static struct menu_entry vectorscope_menus[] = {
+	{
+		.priv		= &vectorscope_draw,
+		.select		= menu_binary_toggle,
+		.display	= vectorscope_display,
+	},
+};
+
+
+static void
+vectorscope_init( void * unused )
+{
+	menu_add( "Video", vectorscope_menus, COUNT(vectorscope_menus) );
+	overlay_register( &vectorscope_layer );
+}
+
+INIT_FUNC( __FILE__, vectorscope_init );
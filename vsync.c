@@ -0,0 +1,205 @@
+/** \file
+ * LiveView frame scheduler.
+ *
+ * The firmware can call back when a VRAM buffer has been written
+ * with vram_schedule_callback().  The handler only gives a semaphore;
+ * the overlay task sleeps on it and then picks up the buffer that
+ * vram_get_number() reports as complete.
+ *
+ * The callback is not in the stubs for every firmware version, so it
+ * is a weak reference.  Without it, or if it stops firing, the task
+ * falls back to checking for the buffer number to flip every few ms.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+#include "config.h"
+#include "vsync.h"
+
+/** Give up on the callback after this many timeouts in a row */
+#define VSYNC_MAX_MISSES	3
+
+/** Never drop more than this many frames for one slow pass */
+#define VSYNC_MAX_SKIP		8
+
+CONFIG_INT( "vsync.budget",	vsync_budget,	60 );	// percent of a frame
+CONFIG_INT( "vsync.poll",	vsync_poll,	5 );	// ms, without callback
+
+extern void
+vram_schedule_callback(
+	struct vram_info *	vram,
+	int			arg1,
+	int			arg2,
+	int			width,
+	int			height,
+	void			(*handler)( void * ),
+	void *			arg
+) __attribute__((weak));
+
+
+struct vsync_stats vsync_stats;
+
+static struct semaphore *	vsync_sem;
+static uint32_t			vsync_buffer = ~0;	//!< Last stable buffer
+static uint32_t			vsync_time;		//!< digic_timer() at that frame
+static unsigned			vsync_skip;		//!< Frames still to drop
+static unsigned			vsync_misses;
+
+
+static void
+vsync_handler( void * unused )
+{
+	give_semaphore( vsync_sem );
+}
+
+
+/** Block until a new buffer is ready.  Returns 0 on timeout. */
+static int
+vsync_next(
+	unsigned		timeout
+)
+{
+	if( vram_schedule_callback && !vsync_stats.polling )
+	{
+		// The callback is one-shot, so it is armed again for
+		// every frame that we wait on.
+		struct vram_info * vram = &vram_info[ vram_get_number(2) ];
+		vram_schedule_callback(
+			vram,
+			0,
+			0,
+			vram->width,
+			vram->height,
+			vsync_handler,
+			0
+		);
+
+		if( take_semaphore( vsync_sem, timeout ) == 0 )
+		{
+			vsync_misses = 0;
+			return 1;
+		}
+
+		if( ++vsync_misses >= VSYNC_MAX_MISSES )
+		{
+			DebugMsg( DM_MAGIC, 3, "%s: no callback, polling", __func__ );
+			vsync_stats.polling = 1;
+		}
+
+		return 0;
+	}
+
+	// No callback; wait for the buffer to flip.  vsync.poll = 0
+	// would never advance waited, so poll at least once a ms.
+	unsigned waited;
+	const unsigned poll = vsync_poll ? vsync_poll : 1;
+
+	for( waited = 0 ; waited < timeout ; waited += poll )
+	{
+		if( vram_get_number(2) != vsync_buffer )
+			return 1;
+		msleep( poll );
+	}
+
+	return 0;
+}
+
+
+/** Update the running estimate of the frame period.  The time since
+ * the last frame that we saw may cover several frames if a pass was
+ * slow, so it is divided by the nearest whole number of periods.
+ */
+static void
+vsync_update_period(
+	uint32_t		dt
+)
+{
+	uint32_t period = vsync_stats.period;
+	if( period == 0 )
+	{
+		vsync_stats.period = dt;
+		return;
+	}
+
+	unsigned frames = (dt + period / 2) / period;
+	if( frames == 0 )
+		frames = 1;
+
+	vsync_stats.period = (period * 7 + dt / frames) / 8;
+}
+
+
+struct vram_info *
+vsync_wait(
+	unsigned		timeout
+)
+{
+	while(1)
+	{
+		if( !vsync_next( timeout ) )
+			return NULL;
+
+		const uint32_t now = digic_timer();
+		if( vsync_buffer != (uint32_t) ~0 )
+			vsync_update_period( (now - vsync_time) & DIGIC_TIMER_MASK );
+
+		vsync_time = now;
+		vsync_buffer = vram_get_number(2);
+
+		if( vsync_skip == 0 )
+			break;
+
+		vsync_skip--;
+		vsync_stats.skipped++;
+	}
+
+	vsync_stats.frames++;
+	return &vram_info[ vsync_buffer ];
+}
+
+
+void
+vsync_done(
+	uint32_t		elapsed
+)
+{
+	vsync_stats.pass = elapsed;
+
+	const uint32_t budget = (vsync_stats.period * vsync_budget) / 100;
+	if( budget == 0 || elapsed <= budget )
+		return;
+
+	// Drop enough frames to bring the average back into budget
+	unsigned skip = (elapsed - 1) / budget;
+	if( skip > VSYNC_MAX_SKIP )
+		skip = VSYNC_MAX_SKIP;
+	vsync_skip = skip;
+}
+
+
+static void
+vsync_init( void * unused )
+{
+	vsync_sem = create_named_semaphore( "vsync", 0 );
+	vsync_stats.polling = !vram_schedule_callback;
+}
+
+INIT_FUNC( __FILE__, vsync_init );
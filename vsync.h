@@ -0,0 +1,66 @@
+#ifndef _vsync_h_
+#define _vsync_h_
+
+/** \file
+ * LiveView frame scheduler.
+ *
+ * Wakes the overlay task once per new LiveView buffer instead of
+ * polling on a fixed sleep, and tells it which of the two buffers
+ * from vram_get_number() is stable.  If the overlay pass takes
+ * longer than its share of the frame the scheduler drops frames so
+ * that the overlays stay in step with the image.
+ */
+/*
+ * Copyright (C) 2009 Trammell Hudson <hudson+ml@osresearch.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include "dryos.h"
+
+
+struct vsync_stats
+{
+	uint32_t		frames;		//!< Frames handed out
+	uint32_t		skipped;	//!< Frames dropped for overruns
+	uint32_t		period;		//!< Average frame period in us
+	uint32_t		pass;		//!< Last overlay pass in us
+	uint32_t		polling;	//!< 1 if there is no callback
+};
+
+extern struct vsync_stats vsync_stats;
+
+
+/** Sleep until the next frame that should be processed.
+ * Returns the stable LiveView buffer, or NULL after timeout ms
+ * without a new frame.
+ */
+extern struct vram_info *
+vsync_wait(
+	unsigned		timeout
+);
+
+
+/** Report how long the pass over the last frame took, in us.
+ * Frames are skipped if it was over the budget.
+ */
+extern void
+vsync_done(
+	uint32_t		elapsed
+);
+
+#endif
@@ -29,15 +29,20 @@
 #include "config.h"
 #include "menu.h"
 #include "property.h"
+#include "overlay.h"
+#include "swar.h"
+#include "span.h"
+#include "cropmark.h"
+#include "blit.h"
+#include "vsync.h"
+#include "exposure.h"
+#include "peaking.h"
 
 
-static struct bmp_file_t * cropmarks;
+static const struct cropmark * cropmarks;
 static volatile unsigned lv_drawn = 0;
 static volatile unsigned sensor_cleaning = 1;
 
-#define vram_start_line	33
-#define vram_end_line	380
-
 #define hist_height			64
 #define hist_width			128
 #define waveform_height			256
@@ -45,13 +50,24 @@ static volatile unsigned sensor_cleaning = 1;
 
 CONFIG_INT( "zebra.draw",	zebra_draw,	1 );
 CONFIG_INT( "zebra.level",	zebra_level,	0xF000 );
+CONFIG_INT( "zebra.level-lo",	zebra_level_lo,	0 ); // luma, 0 is off
 CONFIG_INT( "crop.draw",	crop_draw,	1 );
 CONFIG_STR( "crop.file",	crop_file,	"A:/cropmarks.bmp" );
+CONFIG_INT( "crop.index",	crop_index,	0 );
 CONFIG_INT( "edge.draw",	edge_draw,	0 );
+CONFIG_INT( "falsecolor.draw",	falsecolor_draw, 0 );
+CONFIG_STR( "falsecolor.bands",	falsecolor_bands,
+	"12:14 25:11 105:0 120:7 240:0 250:15 255:8" );
 CONFIG_INT( "enable-liveview",	enable_liveview, 1 );
 CONFIG_INT( "hist.draw",	hist_draw,	1 );
 CONFIG_INT( "hist.x",		hist_x,		720 - hist_width - 4 );
 CONFIG_INT( "hist.y",		hist_y,		100 );
+CONFIG_INT( "hist.roi",		hist_roi,	0 );
+CONFIG_INT( "hist.roi-x",	hist_roi_x,	300 );
+CONFIG_INT( "hist.roi-y",	hist_roi_y,	180 );
+CONFIG_INT( "hist.roi-w",	hist_roi_w,	120 );
+CONFIG_INT( "hist.roi-h",	hist_roi_h,	120 );
+CONFIG_INT( "exposure.stats",	exposure_stats,	1 ); // gather without the boxes
 CONFIG_INT( "waveform.draw",	waveform_draw,	0 );
 CONFIG_INT( "waveform.x",	waveform_x,	720 - waveform_width );
 CONFIG_INT( "waveform.y",	waveform_y,	480 - 50 - waveform_height );
@@ -64,204 +80,432 @@ CONFIG_INT( "timecode.warning",	timecode_warning, 120 );
 static unsigned timecode_font	= FONT(FONT_MED, COLOR_RED, COLOR_BG );
 
 
-/** Sobel edge detection */
-static int32_t
-edge_detect(
-	uint32_t *		buf,
-	uint32_t		pitch
+static unsigned
+check_zebra(
+	const struct overlay_pixel *	px
 )
-{	
-	const uint32_t		pixel1	= buf[0];
-	const int32_t		p00	= (pixel1 & 0xFFFF);
-	const int32_t		p01	= pixel1 >> 16;
-	const uint32_t		pixel2	= buf[1];
-	const int32_t		p02	= (pixel2 & 0xFFFF);
-	const uint32_t		pixel3	= buf[pitch];
-	const int32_t		p10	= (pixel3 & 0xFFFF);
-	const int32_t		p11	= pixel3 >> 16;
-	const uint32_t		pixel4	= buf[pitch+1];
-	const int32_t		p12	= (pixel4 & 0xFFFF);
-	
-	int32_t sx1 = p00 - p11;
-	int32_t sy1 = p01 - p10;
-	
-	int32_t sx2 = p01 - p12;
-	int32_t sy2 = p02 - p11;
+{
+	const uint8_t zebra_color_0 = COLOR_BG; // 0x6F; // bright read
+	const uint8_t zebra_color_1 = 0x5F; // dark red
+	const uint8_t zebra_color_lo = COLOR_BLUE;
 
-	// abs value
-	sx1 = ( sx1 ^ (sx1 >> 15) ) - (sx1 >> 15);
-	sy1 = ( sy1 ^ (sy1 >> 15) ) - (sy1 >> 15);
-	
-	sx2 = ( sx2 ^ (sx2 >> 15) ) - (sx2 >> 15);
-	sy2 = ( sy2 ^ (sy2 >> 15) ) - (sy2 >> 15);
-	
-	return (((sx2 + sy2) >> 1 ) & 0xFF00 ) | ((sx1 + sy1) >> 9);
+	// zebra.level is kept in the old 16-bit units; a level of
+	// zero still marks every pixel.
+	const uint32_t hi = zebra_level >> 8 ? zebra_level >> 8 : 1;
+	uint32_t over, under;
+
+	// If neither pixel is over or under exposed, ignore it
+	if( !swar_zebra( px->pixel, hi, zebra_level_lo, &over, &under ) )
+		return 0;
+
+	// Determine if we are a zig or a zag line
+	uint32_t zag = ((px->y >> 3) ^ (px->x >> 3)) & 1;
+
+	// Build the 16-bit word to write both pixels
+	// simultaneously into the BMP VRAM.  Pixels that are not
+	// flagged keep the transparent background.
+	const uint32_t over_mask = swar_mask_bytes( over );
+	const uint32_t under_mask = swar_mask_bytes( under ) & ~over_mask;
+	const uint32_t over_color = zag
+		? (zebra_color_0<<8) | (zebra_color_0<<0)
+		: (zebra_color_1<<8) | (zebra_color_1<<0);
+	const uint32_t under_color = zag
+		? (zebra_color_lo<<8) | (zebra_color_lo<<0)
+		: 0;
+
+	px->b_row[px->x/2] = (over_color & over_mask)
+		| (under_color & under_mask);
+	return 1;
 }
 
 
-static unsigned
-check_edge(
-	unsigned		x,
-	unsigned		y,
-	uint16_t *		b_row,
-	uint32_t *		v_row,
-	unsigned		vram_pitch
+/** False colour palette, one BMP color per luma; 0 is transparent */
+static uint8_t falsecolor_lut[ 256 ];
+
+
+/** Parse an unsigned decimal number, skipping anything before it */
+static const char *
+falsecolor_parse(
+	const char *		s,
+	unsigned *		val
 )
 {
-	const unsigned dx = x/2;
-	// Check for contrast
-	uint32_t grad = edge_detect(
-		&v_row[dx],
-		vram_pitch
-	);
-	
-	// Check for any high gradients in either pixel
-	if( (grad & 0xF8F8) == 0 )
+	while( *s && (*s < '0' || *s > '9') )
+		s++;
+	if( !*s )
 		return 0;
 
-	// Color coding (using the blue colors starting at 0x70)
-	b_row[dx] = 0x7070 | ((grad & 0xF8F8) >> 3) ;			
-	return 1;
-	
+	unsigned v = 0;
+	while( '0' <= *s && *s <= '9' )
+		v = v * 10 + *s++ - '0';
+
+	*val = v > 255 ? 255 : v;
+	return s;
 }
 
 
+/** Build the lookup table from falsecolor.bands.
+ *
+ * The bands are "luma:color" pairs in increasing luma; each color
+ * runs up to and including its luma.  Anything past the last band
+ * is transparent.
+ */
+static void
+falsecolor_load( void )
+{
+	const char * s = falsecolor_bands;
+	unsigned luma = 0;
+	unsigned upto, color;
+
+	while( s && luma < 256 )
+	{
+		if( !(s = falsecolor_parse( s, &upto )) )
+			break;
+		if( !(s = falsecolor_parse( s, &color )) )
+			break;
+
+		for( ; luma <= upto ; luma++ )
+			falsecolor_lut[ luma ] = color;
+	}
+
+	for( ; luma < 256 ; luma++ )
+		falsecolor_lut[ luma ] = COLOR_EMPTY;
+}
+
+
+/** One table lookup per pixel, both pixels in one store */
 static unsigned
-check_zebra(
-	unsigned		x,
-	unsigned		y,
-	uint16_t *		b_row,
-	uint32_t *		v_row,
-	unsigned		vram_pitch
+check_falsecolor(
+	const struct overlay_pixel *	px
 )
 {
-	const uint8_t zebra_color_0 = COLOR_BG; // 0x6F; // bright read
-	const uint8_t zebra_color_1 = 0x5F; // dark red
-
-	uint32_t pixel = v_row[x/2];
-	uint32_t p0 = (pixel >> 16) & 0xFFFF;
-	uint32_t p1 = (pixel >>  0) & 0xFFFF;
+	const uint32_t luma = swar_luma( px->pixel );
+	const uint32_t color = 0
+		| falsecolor_lut[ luma & 0xFF ] << 0
+		| falsecolor_lut[ luma >> 16 ] << 8;
 
-	// If neither pixel is overexposed, ignore it
-	if( p0 < zebra_level && p1 < zebra_level )
+	if( !color )
 		return 0;
 
-	// Determine if we are a zig or a zag line
-	uint32_t zag = ((y >> 3) ^ (x >> 3)) & 1;
+	px->b_row[px->x/2] = color;
+	return 1;
+}
 
-	// Build the 16-bit word to write both pixels
-	// simultaneously into the BMP VRAM
-	uint16_t zebra_color_word = zag
-		? (zebra_color_0<<8) | (zebra_color_0<<0)
-		: (zebra_color_1<<8) | (zebra_color_1<<0);
 
-	b_row[x/2] = zebra_color_word;
-	return 1;
+static void
+crop_span(
+	uint8_t *		row,
+	unsigned		x0,
+	unsigned		x1,
+	unsigned		y,
+	const struct bmp_map *	map
+)
+{
+	const struct cropmark * const crop = cropmarks;
+	if( !crop )
+		return;
+
+	cropmark_span_row( crop, row, x0, x1, y );
 }
 
 
+/** Outline of the histogram region of interest */
 static unsigned
-check_crop(
-	unsigned		x,
-	unsigned		y,
-	uint16_t *		b_row,
-	uint32_t *		v_row,
-	unsigned		vram_pitch
+check_roi(
+	const struct overlay_pixel *	px
 )
 {
-	if( !cropmarks )
+	const unsigned x = px->x;
+	const unsigned y = px->y;
+	const unsigned x1 = hist_roi_x + hist_roi_w;
+	const unsigned y1 = hist_roi_y + hist_roi_h;
+
+	if( x + 2 <= hist_roi_x || x >= x1 || y < hist_roi_y || y >= y1 )
 		return 0;
 
-	uint8_t * pixbuf = &cropmarks->image[
-		x + cropmarks->width * (cropmarks->height - y)
-	];
-	uint16_t pix = *(uint16_t*) pixbuf;
-	if( pix == 0 )
+	// Two pixel wide border
+	if( y > hist_roi_y + 1 && y < y1 - 2
+	&&  x >= hist_roi_x + 2 && x + 2 < x1 )
 		return 0;
 
-	b_row[ x/2 ] = pix;
+	px->b_row[ x/2 ] = (COLOR_WHITE << 8) | COLOR_WHITE;
 	return 1;
 }
 
 
-/** Store the waveform data for each of the waveform_width bins with
- * 128 levels
+/** Cropmark files that can be switched between in the menu.
+ * The first one is the crop.file setting.
  */
-static uint32_t waveform[ waveform_width ][ waveform_height ];
+#define CROP_FILES		5
 
-/** Store the histogram data for each of the 128 bins */
-static uint32_t hist[ hist_width ];
-
-/** Maximum value in the histogram so that at least one entry fills
- * the box */
-static uint32_t hist_max;
+static void
+crop_file_name(
+	char *			buf,
+	size_t			len,
+	unsigned		index
+)
+{
+	if( index == 0 )
+		snprintf( buf, len, "%s", crop_file );
+	else
+		snprintf( buf, len, "A:/CROPMK%d.BMP", index );
+}
 
 
-/** Generate the histogram data from the YUV frame buffer.
- *
- * Walk the frame buffer two pixels at a time, in 32-bit chunks,
- * to avoid err70 while recording.
- *
- * Average two adjacent pixels to try to reduce noise slightly.
- *
- * Update the hist_max for the largest number of bin entries found
- * to scale the histogram to fit the display box from top to
- * bottom.
+/** Load the selected cropmarks.  Each file is only decoded once, so
+ * switching back to one that was already used is instant.
  */
 static void
-hist_build( void )
+crop_load( void )
 {
-	struct vram_info *	vram = &vram_info[ vram_get_number(2) ];
-	const uint32_t * 	v_row = (uint32_t*) vram->vram;
-	const unsigned		width = vram->width;
-	uint32_t x,y;
+	char name[ 64 ];
 
-	hist_max = 0;
+	if( crop_index >= CROP_FILES )
+		crop_index = 0;
 
-#if 0
-	memset( hist, 0, sizeof(hist) );
-	memset( waveform, 0, sizeof(waveform) );
+	crop_file_name( name, sizeof(name), crop_index );
+	cropmarks = cropmark_load( name );
+	overlay_layout_changed();
+}
+
+
+/** Waveform accumulator.
+ *
+ * The display box is waveform_width x waveform_height pixels, but
+ * the grey scale only has about 42 steps, so the bins are decimated
+ * by waveform.col-shift columns and waveform.level-shift levels and
+ * stored as saturating counters.  The default of 180 columns by 64
+ * levels of bytes is 11 KB instead of the 368 KB of 32-bit bins for
+ * every display pixel.
+ *
+ * The bins of one column are packed together, so a column is one
+ * or two cache lines and the update for each word in the scan only
+ * touches the line for its own column.
+ *
+ * Define WAVEFORM_WIDE_BINS for 16-bit counters if the scope is
+ * used with a large column decimation.
+ *
+ * The bins are never cleared in a separate pass.  Each column is
+ * tagged with the frame epoch that last wrote it; a column with an
+ * old tag reads as zero and is cleared on its first touch in the
+ * new frame.
+ */
+#ifdef WAVEFORM_WIDE_BINS
+typedef uint16_t		waveform_bin_t;
+#define WAVEFORM_BIN_MAX	0xFFFF
 #else
-	// memset() causes err70?  Too much memory bandwidth?
-	for( x=0 ; x<hist_width ; x++ )
-		hist[x] = 0;
-	for( y=0 ; y<waveform_width ; y++ )
-		for( x=0 ; x<waveform_height ; x++ )
-		{
-			waveform[y][x] = 0;
-			asm( "nop\nnop\nnop\nnop\n" );
-		}
+typedef uint8_t			waveform_bin_t;
+#define WAVEFORM_BIN_MAX	0xFF
 #endif
 
-	for( y=vram_start_line ; y<vram_end_line; y++, v_row += (vram->pitch/2) )
+CONFIG_INT( "waveform.col-shift",	waveform_col_shift,	1 );
+CONFIG_INT( "waveform.level-shift",	waveform_level_shift,	2 );
+
+static waveform_bin_t *	waveform;
+static unsigned		waveform_cols;		//!< waveform_width >> col_shift
+static unsigned		waveform_col_bits;	//!< col-shift of the bins
+static unsigned		waveform_level_bits;	//!< log2 of the number of levels
+static unsigned		waveform_size;		//!< Number of bins
+static uint32_t *	waveform_tags;		//!< Epoch of each column
+static uint32_t		waveform_epoch = 1;	//!< Current frame
+
+/** Allocate the waveform bins for the configured decimation, again
+ * if the shifts have changed since.  Called at the start of a frame
+ * so that the whole frame uses one layout.
+ */
+static int
+waveform_alloc( void )
+{
+	if( waveform_col_shift > 3 )
+		waveform_col_shift = 3;
+	if( waveform_level_shift > 4 )
+		waveform_level_shift = 4;
+
+	if( waveform
+	&&  waveform_col_bits == waveform_col_shift
+	&&  waveform_level_bits == 8 - waveform_level_shift )
+		return 1;
+
+	if( waveform )
+		free( waveform );
+	if( waveform_tags )
+		free( waveform_tags );
+
+	waveform_col_bits	= waveform_col_shift;
+	waveform_cols		= waveform_width >> waveform_col_shift;
+	waveform_level_bits	= 8 - waveform_level_shift;
+	waveform_size		= waveform_cols << waveform_level_bits;
+
+	// Columns are whole words for the lazy clear
+	waveform = malloc( waveform_size * sizeof(*waveform) );
+	waveform_tags = malloc( waveform_cols * sizeof(*waveform_tags) );
+	if( !waveform || !waveform_tags )
 	{
-		for( x=0 ; x<width ; x += 2 )
-		{
-			// Average each of the two pixels
-			uint32_t pixel = v_row[x/2];
-			uint32_t p1 = (pixel >> 16) & 0xFFFF;
-			uint32_t p2 = (pixel >>  0) & 0xFFFF;
-			uint32_t p = (p1+p2) / 2;
+		DebugMsg( DM_MAGIC, 3, "%s: unable to allocate %d bins",
+			__func__,
+			waveform_size
+		);
+		if( waveform )
+			free( waveform );
+		if( waveform_tags )
+			free( waveform_tags );
+		waveform = 0;
+		waveform_tags = 0;
+		return 0;
+	}
 
-			uint32_t hist_level = ( p * hist_width ) / 65536;
+	// Every column starts out stale
+	unsigned i;
+	for( i=0 ; i<waveform_cols ; i++ )
+		waveform_tags[i] = 0;
 
-			// Ignore the 0 bin.  It generates too much noise
-			unsigned count = ++hist[ hist_level ];
-			if( hist_level && count > hist_max )
-				hist_max = count;
+	return 1;
+}
 
-			// Update the waveform plot
-			waveform[ (x * waveform_width) / width ][ (p * waveform_height) / 65536 ]++;
-		}
-	}
+
+/** Start a new frame; every column becomes stale */
+static inline void
+waveform_new_frame( void )
+{
+	if( ++waveform_epoch == 0 )
+		waveform_epoch = 1;
+}
+
+
+/** Return the bins for column col of the waveform for writing.
+ * A stale column is cleared first.
+ */
+static inline waveform_bin_t *
+waveform_column(
+	unsigned		col
+)
+{
+	waveform_bin_t * const bins = &waveform[ col << waveform_level_bits ];
+	if( waveform_tags[col] == waveform_epoch )
+		return bins;
+
+	uint32_t * const words = (uint32_t*) bins;
+	const unsigned count = (sizeof(*bins) << waveform_level_bits) / 4;
+	unsigned i;
+	for( i=0 ; i<count ; i++ )
+		words[i] = 0;
+
+	waveform_tags[col] = waveform_epoch;
+	return bins;
+}
+
+
+/** Return the bins for column col for reading, or NULL if the
+ * column has not been touched in this frame.
+ */
+static inline const waveform_bin_t *
+waveform_column_read(
+	unsigned		col
+)
+{
+	if( waveform_tags[col] != waveform_epoch )
+		return 0;
+	return &waveform[ col << waveform_level_bits ];
+}
+
+
+/** Saturating increment of the bin for 8-bit luma y */
+static inline void
+waveform_add(
+	waveform_bin_t *	column,
+	uint32_t		y
+)
+{
+	waveform_bin_t * const bin = &column[ y >> (8 - waveform_level_bits) ];
+	const unsigned count = *bin;
+	if( count != WAVEFORM_BIN_MAX )
+		*bin = count + 1;
+}
+
+
+/** The ROI box in LiveView pixels, through the BMP map */
+static void
+hist_roi_region(
+	unsigned *		x,
+	unsigned *		y,
+	unsigned *		w,
+	unsigned *		h
+)
+{
+	unsigned bx0 = hist_roi_x;
+	unsigned by0 = hist_roi_y;
+	unsigned bx1 = hist_roi_x + hist_roi_w - 1;
+	unsigned by1 = hist_roi_y + hist_roi_h - 1;
+	if( bx1 >= bmp_width() )
+		bx1 = bmp_width() - 1;
+	if( by1 >= bmp_height() )
+		by1 = bmp_height() - 1;
+	if( bx0 > bx1 )
+		bx0 = bx1;
+	if( by0 > by1 )
+		by0 = by1;
+
+	*x = bmp_map.vram_x[ bx0 ];
+	*y = bmp_map.vram_y[ by0 ];
+	*w = bmp_map.vram_x[ bx1 ] - *x + 2;
+	*h = bmp_map.vram_y[ by1 ] - *y + 1;
+}
+
+
+/** Reset the histogram and waveform bins for a new frame.
+ *
+ * The luma bins live in the exposure statistics, so that other
+ * modules can use the same numbers; the waveform columns are
+ * cleared lazily when they are first touched.
+ */
+static void
+hist_clear(
+	const struct vram_info *	vram
+)
+{
+	// Gather the ROI exactly in the same pass
+	unsigned x = 0, y = 0, w = 0, h = 0;
+	if( hist_roi && hist_draw )
+		hist_roi_region( &x, &y, &w, &h );
+	exposure_set_region( x, y, w, h );
+
+	exposure_begin( vram->width, vram->height );
+	waveform_new_frame();
+}
+
+
+/** Add one 32-bit YUV word to the histogram and waveform.
+ *
+ * Both pixels go into the luma bins.  The waveform uses the average
+ * of the two to try to reduce noise slightly.
+ */
+static inline void
+hist_add(
+	unsigned		x,
+	unsigned		y,
+	uint32_t		pixel,
+	waveform_bin_t *	waveform_col
+)
+{
+	exposure_add( x, y, pixel );
+
+	// Update the waveform plot
+	if( waveform_col )
+		waveform_add( waveform_col, swar_luma_avg( pixel ) );
 }
 	
 
+/** Heights of the histogram columns, four to a word */
+static uint32_t hist_sizes[ hist_width / 4 ];
+
+
 /** Draw the histogram image into the bitmap framebuffer.
  *
- * Draw one pixel at a time; it seems to be ok with err70.
- * Since there is plenty of math per pixel this doesn't
- * swamp the bitmap framebuffer hardware.
+ * The column heights are computed once; then each row is emitted
+ * left to right a word at a time.  All four columns of a word are
+ * compared against the row in one go: the heights are at most 64,
+ * so setting the top bit of each byte keeps the subtract from
+ * borrowing across bytes and the top bit survives iff size >= y.
  */
 static void
 hist_draw_image(
@@ -270,35 +514,69 @@ hist_draw_image(
 )
 {
 	uint8_t * const bvram = bmp_vram();
+	const unsigned pitch = bmp_pitch();
 
 	// Align the x origin, just in case
 	x_origin &= ~3;
 
-	uint8_t * row = bvram + x_origin + y_origin * bmp_pitch();
+	uint8_t * row = bvram + x_origin + y_origin * pitch;
+	static uint32_t bins[ EXPOSURE_BINS ];
+	struct exposure_stats stats;
+	exposure_histogram( bins, &stats );
+	uint32_t hist_max = stats.hist_max;
+	unsigned i, y;
+
+	// In ROI mode the coarse region histogram is stretched over
+	// the box instead.
+	static uint32_t roi_bins[ EXPOSURE_TILE_BINS ];
+	const unsigned roi_shift = EXPOSURE_TILE_SHIFT - 1;
+	if( hist_roi )
+	{
+		// The same region that the scan gathered exactly
+		unsigned x, y, w, h;
+		hist_roi_region( &x, &y, &w, &h );
+		exposure_region( x, y, w, h, roi_bins );
+		hist_max = 0;
+		for( i=1 ; i<EXPOSURE_TILE_BINS ; i++ )
+			if( roi_bins[i] > hist_max )
+				hist_max = roi_bins[i];
+	}
+
 	if( hist_max == 0 )
 		hist_max = 1;
 
-	unsigned i, y;
-
+	uint8_t * const sizes = (uint8_t*) hist_sizes;
 	for( i=0 ; i<hist_width ; i++ )
 	{
-		// Scale by the maximum bin value
-		const uint32_t size = (hist[i] * hist_height) / hist_max;
-		uint8_t * col = row + i;
-
-		// vertical line up to the hist size
-		for( y=hist_height ; y>0 ; y-- , col += bmp_pitch() )
-			*col = y > size ? COLOR_BG : COLOR_WHITE;
+		// Two luma bins per column, scaled by the maximum
+		const uint32_t count = hist_roi
+			? roi_bins[ i >> roi_shift ]
+			: bins[2*i] + bins[2*i+1];
+		const uint32_t size = (count * hist_height) / hist_max;
+		sizes[i] = size > hist_height ? hist_height : size;
 	}
 
-	// Draw some extra just to add a black bar on the right side
-	bmp_fill(
-		COLOR_BG,
-		x_origin + hist_width,
-		y_origin,
-		4,
-		hist_height
-	);
+	const uint32_t bg	= COLOR_BG * 0x01010101;
+	const uint32_t fg	= COLOR_WHITE * 0x01010101;
+
+	// One more word for a black bar on the right side
+	static uint32_t line[ hist_width / 4 + 1 ];
+	line[ hist_width / 4 ] = bg;
+
+	for( y=hist_height ; y>0 ; y--, row += pitch )
+	{
+		const uint32_t level = y * 0x01010101;
+
+		for( i=0 ; i<hist_width/4 ; i++ )
+		{
+			const uint32_t ge = ((hist_sizes[i] | 0x80808080) - level)
+				& 0x80808080;
+			const uint32_t mask = (ge >> 7) * 0xFF;
+			line[i] = bg ^ (mask & (bg ^ fg));
+		}
+
+		span_copy( row, (const uint8_t*) line, sizeof(line) );
+	}
 
 	if(0) bmp_printf(
 		FONT(FONT_SMALL,COLOR_RED,COLOR_WHITE),
@@ -307,16 +585,95 @@ hist_draw_image(
 		"max %d",
 		(int) hist_max
 	);
+}
+
+
+/** Waveform count to colour.  The first waveform_lut_zero entries
+ * scale to nothing and are set to the background of the row being
+ * drawn.  Counts above 255 use the last entry.
+ */
+static uint8_t waveform_lut[ 256 ];
+static unsigned waveform_lut_zero;
+
+/** Background of each display row: transparent or a graticule */
+static uint8_t waveform_row_bg[ waveform_height ];
+
+static unsigned waveform_lut_bg = ~0;
+static unsigned waveform_lut_shift = ~0;
+
 
-	hist_max = 0;
+/** Build the colour tables if the background or the decimation
+ * changed.
+ *
+ * The grey scale is 42 steps from 0x26; anything that would scale
+ * past that is drawn in 0x0F.  Each bin sums the samples of
+ * 1 << (col-shift + level-shift) display pixels, so the divisor is
+ * scaled by that to keep the brightness of one display pixel bin.
+ * The graticule is drawn at 1/4, 2/4 and 3/4 of the height where
+ * there is no data.
+ */
+static void
+waveform_lut_build( void )
+{
+	const unsigned shift = waveform_col_bits + 8 - waveform_level_bits;
+	if( waveform_lut_bg == waveform_bg && waveform_lut_shift == shift )
+		return;
+
+	unsigned i;
+	waveform_lut_zero = 0;
+	for( i=0 ; i<256 ; i++ )
+	{
+		const unsigned grey = (i * 42) / (128 << shift);
+		waveform_lut[i] = grey > 42 ? 0x0F : grey + 0x26;
+		if( grey == 0 )
+			waveform_lut_zero = i + 1;
+	}
+
+	for( i=0 ; i<waveform_height ; i++ )
+		waveform_row_bg[i] = waveform_bg;
+
+	waveform_row_bg[ (waveform_height*1)/4 ] = COLOR_BLUE;
+	waveform_row_bg[ (waveform_height*2)/4 ] = 0xE; // pink
+	waveform_row_bg[ (waveform_height*3)/4 ] = COLOR_BLUE;
+
+	waveform_lut_bg = waveform_bg;
+	waveform_lut_shift = shift;
+}
+
+
+/** Compose one row of the waveform into a cached line buffer */
+static void
+waveform_line_build(
+	uint8_t *		line,
+	const waveform_bin_t ** columns,
+	unsigned		level,
+	uint8_t			bg
+)
+{
+	const unsigned cell = 1 << waveform_col_bits;
+	unsigned c, i;
+
+	for( i=0 ; i<waveform_lut_zero ; i++ )
+		waveform_lut[i] = bg;
+
+	for( c=0 ; c<waveform_cols ; c++ )
+	{
+		uint32_t count = columns[c] ? columns[c][level] : 0;
+		if( count > 255 )
+			count = 255;
+
+		const uint8_t color = waveform_lut[ count ];
+		for( i=0 ; i<cell ; i++ )
+			*line++ = color;
+	}
 }
 
 
 /** Draw the waveform image into the bitmap framebuffer.
  *
- * Draw one pixel at a time; it seems to be ok with err70.
- * Since there is plenty of math per pixel this doesn't
- * swamp the bitmap framebuffer hardware.
+ * The rows that share a level are the same apart from the graticule,
+ * so each level is composed once into a line buffer with the colour
+ * table and then copied out as whole words, top row first.
  */
 static void
 waveform_draw_image(
@@ -324,167 +681,251 @@ waveform_draw_image(
 	unsigned		y_origin
 )
 {
+	static const waveform_bin_t * columns[ waveform_width ];
+	static uint32_t line[ waveform_width / 4 ];
+
 	// Ensure that x_origin is quad-word aligned
 	x_origin &= ~3;
 
 	uint8_t * const bvram = bmp_vram();
 	unsigned pitch = bmp_pitch();
 	uint8_t * row = bvram + x_origin + y_origin * pitch;
-	if( hist_max == 0 )
-		hist_max = 1;
+	if( !waveform )
+		return;
+
+	waveform_lut_build();
 
 	unsigned i, y;
+	for( i=0 ; i<waveform_cols ; i++ )
+		columns[i] = waveform_column_read( i );
+
+	unsigned built = ~0;
+	uint8_t built_bg = 0;
 
 	// vertical line up to the hist size
 	for( y=waveform_height-1 ; y>0 ; y-- )
 	{
-		uint32_t pixel = 0;
+		const unsigned level = y >> (8 - waveform_level_bits);
+		const uint8_t bg = waveform_row_bg[y];
 
-		for( i=0 ; i<waveform_width ; i++ )
+		if( level != built || bg != built_bg )
 		{
-
-			uint32_t count = waveform[ i ][ y ];
-			// Scale to a grayscale
-			count = (count * 42) / 128;
-			if( count > 42 )
-				count = 0x0F;
-			else
-			if( count >  0 )
-				count += 0x26;
-			else
-			// Draw a series of colored scales
-			if( y == (waveform_height*1)/4 )
-				count = COLOR_BLUE;
-			else
-			if( y == (waveform_height*2)/4 )
-				count = 0xE; // pink
-			else
-			if( y == (waveform_height*3)/4 )
-				count = COLOR_BLUE;
-			else
-				count = waveform_bg; // transparent
-
-			pixel <<= 8;
-			pixel |= count;
-
-			if( (i & 3) != 3 )
-				continue;
-
-			// Draw the pixel, rounding down to the nearest
-			// quad word write (and then nop to avoid err70).
-			*(uint32_t*)( row + (i & ~3)  ) = pixel;
-			pixel = 0;
-			asm( "nop" );
-			asm( "nop" );
-			asm( "nop" );
-			asm( "nop" );
+			waveform_line_build( (uint8_t*) line, columns, level, bg );
+			built = level;
+			built_bg = bg;
 		}
 
+		span_copy( row, (const uint8_t*) line, waveform_width );
 		row += pitch;
 	}
 }
 
 
-/** Master video overlay drawing code.
- *
- * This routine controls the display of the zebras, histogram,
- * edge detection, cropmarks and so on.
+/** 16.16 scale from VRAM x to waveform column, so that the scan
+ * does not need a divide per word.
+ */
+static unsigned scope_col_scale;
+
+/** Set if the scope data is being gathered for this frame */
+static unsigned scope_running;
+
+static int
+scopes_begin(
+	struct vram_info *	vram
+)
+{
+	scope_running = hist_draw || waveform_draw || exposure_stats;
+	if( !scope_running )
+		return 0;
+
+	if( waveform_draw )
+		waveform_alloc();
+
+	scope_col_scale = vram->width
+		? (waveform_cols << 16) / vram->width
+		: 0;
+	hist_clear( vram );
+	return 1;
+}
+
+
+static void
+scopes_analyse(
+	unsigned		x,
+	unsigned		y,
+	uint32_t		pixel
+)
+{
+	hist_add(
+		x,
+		y,
+		pixel,
+		waveform ? waveform_column( (x * scope_col_scale) >> 16 ) : 0
+	);
+}
+
+
+/** The frame is complete; summarise it before the boxes are drawn */
+static void
+scopes_end( void )
+{
+	if( scope_running )
+		exposure_end();
+}
+
+
+static void
+hist_reserve(
+	struct overlay_rect *	rect
+)
+{
+	rect->x = hist_x;
+	rect->y = hist_y;
+	rect->w = hist_width + 4;
+	rect->h = hist_height;
+}
+
+
+static void
+hist_draw_layer( void )
+{
+	hist_draw_image( hist_x, hist_y );
+}
+
+
+static void
+waveform_reserve(
+	struct overlay_rect *	rect
+)
+{
+	rect->x = waveform_x;
+	rect->y = waveform_y;
+	rect->w = waveform_width;
+	rect->h = waveform_height;
+}
+
+
+static void
+waveform_draw_layer( void )
+{
+	waveform_draw_image( waveform_x, waveform_y );
+}
+
+
+static void
+timecode_reserve(
+	struct overlay_rect *	rect
+)
+{
+	rect->x = timecode_x;
+	rect->y = timecode_y;
+	rect->w = timecode_width;
+	rect->h = timecode_height;
+}
+
+
+/** The overlay layers owned by this module.
  *
  * The stacking order of the overlays is:
  *
- * - Histogram
+ * - Histogram and waveform boxes
  * - Cropping bitmap
- * - Zebras
  * - Edge detection
+ * - False colour
+ * - Zebras
  *
- * This should be done with a proper OO controller that allows modules
- * to register new drawing functions, but for right now they are hardcoded.
+ * The scope layer only gathers the histogram, waveform and exposure
+ * data; it sees every word in the scan, including the reserved boxes.
+ * Its draw() hook runs first, so the statistics are ready before the
+ * boxes are drawn.
  */
-static void
-draw_zebra( void )
-{
-	uint8_t * const bvram = bmp_vram();
-
-	// If we don't have a bitmap vram yet, nothing to do.
-	if( !bvram )
-		return;
-
-	// If we are not drawing edges, or zebras or crops, nothing to do
-	if( !edge_draw && !zebra_draw && !hist_draw && !waveform_draw )
+static struct overlay_layer zebra_layers[] = {
 	{
-		if( !crop_draw )
-			return;
-		if( !cropmarks )
-			return;
-	}
+		.name		= "scopes",
+		.z		= 0,
+		.begin		= scopes_begin,
+		.analyse	= scopes_analyse,
+		.draw		= scopes_end,
+	},
+	{
+		.name		= "zebra",
+		.z		= 10,
+		.enabled	= &zebra_draw,
+		.pixel		= check_zebra,
+	},
+	{
+		.name		= "falsecolor",
+		.z		= 15,
+		.enabled	= &falsecolor_draw,
+		.pixel		= check_falsecolor,
+	},
+	{
+		.name		= "edge",
+		.z		= 20,
+		.enabled	= &edge_draw,
+		.begin		= peaking_begin,
+		.analyse	= peaking_analyse,
+		.pixel		= peaking_pixel,
+	},
+	{
+		.name		= "timecode",
+		.z		= 90,
+		.reserve	= timecode_reserve,
+	},
+	{
+		.name		= "histogram",
+		.z		= 100,
+		.enabled	= &hist_draw,
+		.reserve	= hist_reserve,
+		.draw		= hist_draw_layer,
+	},
+	{
+		.name		= "waveform",
+		.z		= 110,
+		.enabled	= &waveform_draw,
+		.reserve	= waveform_reserve,
+		.draw		= waveform_draw_layer,
+	},
+};
 
-	struct vram_info * vram = &vram_info[ vram_get_number(2) ];
+static struct overlay_layer roi_layer = {
+	.name		= "hist-roi",
+	.z		= 40,
+	.enabled	= &hist_roi,
+	.pixel		= check_roi,
+};
 
-	hist_build();
+/** Draws nothing while no cropmark file is loaded */
+static struct overlay_layer crop_layer = {
+	.name		= "cropmarks",
+	.z		= 30,
+	.enabled	= &crop_draw,
+	.span		= crop_span,
+};
 
-	// skip the audio meter at the top and the bar at the bottom
-	// hardcoded; should use a constant based on the type of display
-	// 33 is the bottom of the meters; 55 is the crop mark
-	uint32_t x,y;
-	for( y=33 ; y < 390; y++ )
-	{
-		uint32_t * const v_row = (uint32_t*)( vram->vram + y * vram->pitch );
-		uint16_t * const b_row = (uint16_t*)( bvram + y * bmp_pitch() );
 
-		// Iterate over the pixels in the scan row
-		// two at a time to read the pixel buf in 32 bit chunks
-		// otherwise we get err70 aborts while drawing regions
-		// in the bitmap vram.
-		for( x=2 ; x < vram->width-2 ; x+=2 )
-		{
-			// Abort as soon as the new menu is drawn
-			if( gui_menu_task || !lv_drawn )
-				return;
-
-			// Ignore the regions where the histogram will be drawn
-			if( hist_draw
-			&&  y >= hist_y
-			&&  y <  hist_y + hist_height
-			&&  x >= hist_x
-			&&  x <  hist_x + hist_width + 4
-			)
-				continue;
-
-			// Ignore the regions where the waveform will be drawn
-			if( waveform_draw
-			&&  y >= waveform_y
-			&&  y <  waveform_y + waveform_height
-			&&  x >= waveform_x
-			&&  x <  waveform_x + waveform_width
-			)
-				continue;
-
-			// Ignore the timecode region
-			if( y >= timecode_y
-			&&  y <  timecode_y + timecode_height
-			&&  x >= timecode_x
-			&&  x <  timecode_x + timecode_width
-			)
-				continue;
-
-			if( crop_draw && check_crop( x, y, b_row, v_row, vram->pitch ) )
-				continue;
-
-			if( edge_draw && check_edge( x, y, b_row, v_row, vram->pitch ) )
-				continue;
-
-			if( zebra_draw && check_zebra( x, y, b_row, v_row, vram->pitch ) )
-				continue;
-
-			// Nobody drew on it, make it clear
-			b_row[x/2] = 0;
-		}
-	}
+/** Master video overlay drawing code.
+ *
+ * This routine controls the display of the zebras, histogram,
+ * edge detection, cropmarks and so on.  Each of them is an overlay
+ * layer; the engine in overlay.c walks the LiveView buffer once and
+ * only runs the pixel layers outside of the reserved boxes.
+ *
+ * Each call only scans as many rows as fit in overlay.tick-budget;
+ * the rest of the frame is done on the following LiveView frames.
+ */
+static void
+draw_zebra(
+	struct vram_info *	vram
+)
+{
+	// If we are not drawing edges, or zebras or crops, nothing to do
+	if( !overlay_active() )
+		return;
 
-	if( hist_draw )
-		hist_draw_image( hist_x, hist_y );
-	if( waveform_draw )
-		waveform_draw_image( waveform_x, waveform_y );
+	const uint32_t start = digic_timer();
+	overlay_draw( vram, &lv_drawn );
+	vsync_done( digic_timer_elapsed( start ) );
 }
 
 
@@ -499,7 +940,7 @@ zebra_toggle( void * priv )
 static void
 zebra_display( void * priv, int x, int y, int selected )
 {
-	bmp_printf( 
+	bmp_cell_printf( 
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -508,10 +949,22 @@ zebra_display( void * priv, int x, int y, int selected )
 	);
 }
 
+static void
+falsecolor_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		//23456789012
+		"False color: %s",
+		*(unsigned*) priv ? "ON " : "OFF"
+	);
+}
+
 static void
 zebra_draw_display( void * priv, int x, int y, int selected )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -525,7 +978,7 @@ crop_display( void * priv, int x, int y, int selected )
 {
 	extern int retry_count;
 
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -536,10 +989,57 @@ crop_display( void * priv, int x, int y, int selected )
 }
 
 
+static void
+crop_file_toggle( void * priv )
+{
+	crop_index = (crop_index + 1) % CROP_FILES;
+	crop_load();
+}
+
+
+/** Draw the selected cropmark file straight from the BMP over the
+ * menu, to check it without leaving the menu or starting live view.
+ */
+static void
+crop_preview( void * priv )
+{
+	char name[ 64 ];
+	crop_file_name( name, sizeof(name), crop_index );
+
+	struct bmp_file_t * const bmp = bmp_load( name );
+	struct bmp_image * const image = bmp_image_from_bmp( bmp, 0 );
+
+	if( image )
+		bmp_blit( image, 0, 0 );
+	else
+		bmp_printf( FONT_MED, 0, 200, "Cannot preview %s", name );
+
+	bmp_image_free( image );
+	if( bmp )
+		free( bmp );
+}
+
+
+static void
+crop_file_display( void * priv, int x, int y, int selected )
+{
+	char name[ 64 ];
+	crop_file_name( name, sizeof(name), crop_index );
+
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		//23456789012
+		"Crop file:  %s",
+		cropmarks ? name + 3 : "NO FILE"
+	);
+}
+
+
 static void
 edge_display( void * priv, int x, int y, int selected )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -552,7 +1052,7 @@ edge_display( void * priv, int x, int y, int selected )
 static void
 hist_display( void * priv, int x, int y, int selected )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -561,10 +1061,42 @@ hist_display( void * priv, int x, int y, int selected )
 	);
 }
 
+static void
+hist_roi_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		//23456789012
+		"Hist ROI:   %s %d,%d",
+		*(unsigned*) priv ? "ON " : "OFF",
+		hist_roi_x,
+		hist_roi_y
+	);
+}
+
+
+/** Step the region of interest across the frame, left to right and
+ * then down, one region width at a time.
+ */
+static void
+hist_roi_move( void * priv )
+{
+	hist_roi_x += hist_roi_w;
+	if( hist_roi_x + hist_roi_w > bmp_width() )
+	{
+		hist_roi_x = 0;
+		hist_roi_y += hist_roi_h;
+		if( hist_roi_y + hist_roi_h > bmp_height() )
+			hist_roi_y = 0;
+	}
+}
+
+
 static void
 waveform_display( void * priv, int x, int y, int selected )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -576,7 +1108,7 @@ waveform_display( void * priv, int x, int y, int selected )
 static void
 liveview_display( void * priv, int x, int y, int selected )
 {
-	bmp_printf(
+	bmp_cell_printf(
 		selected ? MENU_FONT_SEL : MENU_FONT,
 		x, y,
 		//23456789012
@@ -601,16 +1133,41 @@ struct menu_entry zebra_menus[] = {
 		.select		= menu_binary_toggle,
 		.display	= crop_display,
 	},
+	{
+		.priv		= &crop_index,
+		.select		= crop_file_toggle,
+		.display	= crop_file_display,
+	},
+	{
+		.priv		= "Crop preview",
+		.select		= crop_preview,
+		.display	= menu_print,
+	},
 	{
 		.priv		= &edge_draw,
 		.select		= menu_binary_toggle,
 		.display	= edge_display,
 	},
+	{
+		.priv		= &falsecolor_draw,
+		.select		= menu_binary_toggle,
+		.display	= falsecolor_display,
+	},
 	{
 		.priv		= &hist_draw,
 		.select		= menu_binary_toggle,
 		.display	= hist_display,
 	},
+	{
+		.priv		= &hist_roi,
+		.select		= menu_binary_toggle,
+		.display	= hist_roi_display,
+	},
+	{
+		.priv		= "Move hist ROI",
+		.select		= hist_roi_move,
+		.display	= menu_print,
+	},
 	{
 		.priv		= &waveform_draw,
 		.select		= menu_binary_toggle,
@@ -624,6 +1181,215 @@ struct menu_entry zebra_menus[] = {
 };
 
 
+/** The histogram and waveform pass as it was before the scopes were
+ * moved into the overlay scan: a full clear of the 360 x 256 word
+ * waveform, one word at a time with nops against err70, and then
+ * a division per bin.  Kept here, on private buffers, only to give
+ * the bench a fixed baseline.  Returns the time in microseconds.
+ */
+#define scope_bench_cols	(720/2)
+#define scope_bench_levels	256
+
+static uint32_t
+scope_bench_baseline(
+	struct vram_info *	vram,
+	uint32_t *		old_waveform,
+	uint32_t *		old_hist
+)
+{
+	const uint32_t start = digic_timer();
+	const unsigned width = vram->width;
+	uint32_t old_max = 0;
+	unsigned x, y;
+
+	for( x=0 ; x<hist_width ; x++ )
+		old_hist[x] = 0;
+	for( y=0 ; y<scope_bench_cols ; y++ )
+		for( x=0 ; x<scope_bench_levels ; x++ )
+		{
+			old_waveform[ y * scope_bench_levels + x ] = 0;
+			asm( "nop\nnop\nnop\nnop\n" );
+		}
+
+	for( y=33 ; y<390 ; y++ )
+	{
+		const uint32_t * const v_row = (uint32_t*)( vram->vram + y * vram->pitch );
+		for( x=0 ; x<width ; x += 2 )
+		{
+			uint32_t pixel = v_row[x/2];
+			uint32_t p1 = (pixel >> 16) & 0xFFFF;
+			uint32_t p2 = (pixel >>  0) & 0xFFFF;
+			uint32_t p = (p1+p2) / 2;
+
+			uint32_t hist_level = ( p * hist_width ) / 65536;
+
+			unsigned count = ++old_hist[ hist_level ];
+			if( hist_level && count > old_max )
+				old_max = count;
+
+			old_waveform[
+				((x * scope_bench_cols) / width) * scope_bench_levels
+				+ (p * scope_bench_levels) / 65536
+			]++;
+		}
+	}
+
+	return digic_timer_elapsed( start );
+}
+
+
+/** One frame of the current scope analysis over the same rows.
+ * The bins belong to the overlay task, so this runs under the
+ * overlay lock and makes the overlay start its frame over.
+ */
+static uint32_t
+scope_bench_frame(
+	struct vram_info *	vram
+)
+{
+	uint32_t elapsed = 0;
+	unsigned x, y;
+
+	overlay_lock();
+
+	const unsigned old_draw = waveform_draw;
+	waveform_draw = 1;
+
+	const uint32_t start = digic_timer();
+	if( scopes_begin( vram ) )
+	{
+		for( y=33 ; y<390 ; y++ )
+		{
+			const uint32_t * const v_row = (uint32_t*)( vram->vram + y * vram->pitch );
+			for( x=0 ; x<vram->width ; x += 2 )
+				scopes_analyse( x, y, v_row[x/2] );
+		}
+		elapsed = digic_timer_elapsed( start );
+	}
+
+	waveform_draw = old_draw;
+
+	// The half gathered frame of the overlay is gone
+	overlay_layout_changed();
+	overlay_unlock();
+
+	return elapsed;
+}
+
+
+/** Compare the per-frame cost of the old full-frame scope pass
+ * against the current one on the live image.
+ */
+static void
+scope_bench( void * priv )
+{
+	struct vram_info * vram = &vram_info[ vram_get_number(2) ];
+	const unsigned frames = 16;
+	uint32_t old = 0, now = 0;
+	unsigned i;
+
+	if( !vram->vram )
+		return;
+
+	uint32_t * const old_waveform = malloc(
+		scope_bench_cols * scope_bench_levels * sizeof(*old_waveform)
+	);
+	uint32_t * const old_hist = malloc( hist_width * sizeof(*old_hist) );
+
+	if( !old_waveform || !old_hist )
+	{
+		bmp_printf( FONT_MED, 0, 200, "scope bench: no memory" );
+		goto done;
+	}
+
+	for( i=0 ; i<frames ; i++ )
+	{
+		old += scope_bench_baseline( vram, old_waveform, old_hist );
+		now += scope_bench_frame( vram );
+		msleep( 10 );
+	}
+
+	bmp_printf( FONT_MED, 0, 200,
+		"scope pass: old %5d us now %5d us",
+		old / frames,
+		now / frames
+	);
+
+done:
+	if( old_waveform )
+		free( old_waveform );
+	if( old_hist )
+		free( old_hist );
+}
+
+
+static void
+vsync_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		"Frame %5dus %s pass %5dus skip %d",
+		vsync_stats.period,
+		vsync_stats.polling ? "poll" : "sync",
+		vsync_stats.pass,
+		vsync_stats.skipped
+	);
+}
+
+
+static void
+overlay_stats_display( void * priv, int x, int y, int selected )
+{
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		"Overlay %3d.%02d Hz in %d ticks",
+		overlay_stats.refresh / 100,
+		overlay_stats.refresh % 100,
+		overlay_stats.ticks
+	);
+}
+
+
+static void
+exposure_display( void * priv, int x, int y, int selected )
+{
+	struct exposure_stats stats;
+	exposure_get( &stats );
+
+	bmp_cell_printf(
+		selected ? MENU_FONT_SEL : MENU_FONT,
+		x, y,
+		"Luma %3d/%3d %3d-%3d clip %3d/%3d",
+		stats.mean,
+		stats.median,
+		stats.pct_lo,
+		stats.pct_hi,
+		stats.clip_lo,
+		stats.clip_hi
+	);
+}
+
+
+static struct menu_entry zebra_debug_menus[] = {
+	{
+		.priv		= "Scope bench",
+		.select		= scope_bench,
+		.display	= menu_print,
+	},
+	{
+		.display	= vsync_display,
+	},
+	{
+		.display	= overlay_stats_display,
+	},
+	{
+		.display	= exposure_display,
+	},
+};
+
+
 PROP_HANDLER( PROP_LV_ACTION )
 {
 	// LV_START==0, LV_STOP=1
@@ -665,7 +1431,7 @@ PROP_HANDLER( PROP_REC_TIME )
 {
 	unsigned value = buf[0];
 	value /= 200; // why? it seems to work out
-	bmp_printf(
+	bmp_cell_printf(
 		value < timecode_warning ? timecode_font : FONT_MED,
 		timecode_x + 5 * fontspec_width(timecode_font),
 		timecode_y,
@@ -681,7 +1447,8 @@ static void
 zebra_task( void * unused )
 {
 	lv_drawn = 0;
-	cropmarks = bmp_load( crop_file );
+	crop_load();
+	falsecolor_load();
 
 	DebugMsg( DM_MAGIC, 3,
 		"%s: Zebras=%s threshold=%x cropmarks=%x liveview=%d",
@@ -695,10 +1462,8 @@ zebra_task( void * unused )
 	if( cropmarks )
 	{
 		DebugMsg( DM_MAGIC, 3,
-			"Cropmarks: %dx%d @ %d",
-			cropmarks->width,
-			cropmarks->height,
-			cropmarks->bits_per_pixel
+			"Cropmarks: %d spans",
+			cropmarks->count
 		);
 	}
 
@@ -718,17 +1483,29 @@ zebra_task( void * unused )
 
 
 	menu_add( "Video", zebra_menus, COUNT(zebra_menus) );
+	menu_add( "Debug", zebra_debug_menus, COUNT(zebra_debug_menus) );
+
+	unsigned i;
+	for( i=0 ; i<COUNT(zebra_layers) ; i++ )
+		overlay_register( &zebra_layers[i] );
+	overlay_register( &crop_layer );
+	overlay_register( &roi_layer );
 
 	while(!shutdown_requested)
 	{
 		if( !gui_menu_task && lv_drawn )
 		{
-			draw_zebra();
-			msleep( 100 );
+			// Sleep until the next LiveView frame is ready
+			struct vram_info * vram = vsync_wait( 200 );
+			if( vram )
+				draw_zebra( vram );
 		} else {
 			// Don't display the zebras over the menu.
 			// wait a while and then try again
 			// Should sleep until we go into lv mode?
+			// The menu draws over the overlays, so make sure
+			// they are all repainted when we come back.
+			overlay_layout_changed();
 			msleep( 500 );
 		}
 	}